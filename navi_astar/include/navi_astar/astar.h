@@ -2,8 +2,8 @@
 #define ASTAR_H_
 
 #include <algorithm>
+#include <limits>
 #include <vector>
-#include <boost/multi_array.hpp>
 
 #include <ros/ros.h>
 #include <nav_core/base_global_planner.h>
@@ -15,6 +15,11 @@
 #include <geometry_msgs/Point.h>
 #include <nav_msgs/Path.h>
 #include <nav_msgs/GetPlan.h>
+#include <navi_astar/distance_transform.h>
+#include <navi_astar/dstar_lite.h>
+#include <navi_astar/grid.h>
+#include <navi_astar/hierarchical.h>
+#include <navi_astar/indexed_heap.h>
 
 namespace navi_astar {
 struct Node {
@@ -25,50 +30,92 @@ struct Node {
     bool operator!=(Node const &other) const;
 };
 
-struct Predecessor {
-    Node node;
-    double cost_path, cost_heuristic;
-    bool initialized;
-
-    Predecessor(void);
-    Predecessor(Node node, double cost_path, double cost_heuristic);
-    bool operator<(Predecessor const &other) const;
-};
-
 class AStarPlanner : public nav_core::BaseGlobalPlanner {
 public:
-    typedef boost::multi_array<uint8_t, 2> Array2;
-    typedef boost::multi_array<bool, 2> BinaryArray;
-    typedef boost::multi_array<Predecessor, 2> PredecessorArray;
-    typedef boost::shared_ptr<Array2> Array2Ptr;
-
     static uint8_t const kCostObstacle;
+    static uint8_t const kCostLethal;
     static uint8_t const kCostUnknown;
+    static unsigned int const kNoParent;
+
+    /**
+     * Any-angle path modes. Smoothing shortcuts the grid path along lines of
+     * sight after the search and is nearly free. Theta* checks line of sight
+     * to the parent of the expanded node for every neighbor and Lazy Theta*
+     * only checks once per expanded node; both give shorter paths than
+     * smoothing but pay for a line traversal on every expansion.
+     */
+    enum AnyAngle { kAnyAngleOff = 0, kAnyAngleSmooth, kAnyAngleTheta, kAnyAngleLazy };
 
     AStarPlanner(void);
     AStarPlanner(std::string name, costmap_2d::Costmap2DROS *costmap_ros);
     virtual ~AStarPlanner(void);
 
+    // Search modes; initialize() sets these from parameters.
+    void setIncremental(bool incremental);
+    void setHierarchical(bool hierarchical, double distance);
+    void setAnyAngle(AnyAngle any_angle);
+
     // Search Algorithm
+    void setCostmap(costmap_2d::Costmap2D const &costmap);
+
+    /**
+     * Plan between two cells of the last costmap with the configured search
+     * mode, smoothing the path if requested. The path is left in
+     * getLastPath().
+     *
+     * \param far use the hierarchical search, if it is enabled
+     * 
+eturn false if the goal is blocked or unreachable
+     */
+    bool findPath(Node const &node_start, Node const &node_goal, bool far);
     bool search(Node const &node_start, Node const &node_goal);
+    bool searchIncremental(Node const &node_start, Node const &node_goal);
+    bool searchHierarchical(Node const &node_start, Node const &node_goal);
+    void getPath(Node const &node_goal, std::vector<Node> &path);
+    void smoothPath(std::vector<Node> &path) const;
 
-    Predecessor getPredecessor(Predecessor const &node, Node const &goal, int dx, int dy);
-    Node getNode(double world_x, double world_y);
+    inline size_t getExpansions(void) const { return expansions_; }
+    inline std::vector<Node> const &getLastPath(void) const { return path_; }
+
+    bool getNode(double world_x, double world_y, Node &node);
     double getHeuristicValue(Node const &node, Node const &goal);
 
-    inline bool isInBounds(Node const &node)
+    inline bool isInBounds(int x, int y) const
+    {
+        return 0 <= x && x < (int)width_ && 0 <= y && y < (int)height_;
+    }
+
+    inline unsigned int getIndex(Node const &node) const
+    {
+        return node.y * width_ + node.x;
+    }
+
+    inline Node getNode(unsigned int index) const
+    {
+        return Node(index % width_, index / width_);
+    }
+
+    inline double getEdgeCost(unsigned int from, unsigned int to, double length) const
     {
-        // TODO: Implement this.
-        return true;
+        return 0.5 * (cell_costs_[from] + cell_costs_[to]) * length * resolution_;
     }
 
+    /**
+     * Cost of moving in a straight line between two cells, found by walking
+     * the cells on a Bresenham line between them. The line is not allowed to
+     * cut the corner of an untraversable cell.
+     *
+     * \return infinity if there is no line of sight
+     */
+    double getLineCost(unsigned int from, unsigned int to) const;
+
     // Distance Transform
-    Array2Ptr getBinaryCostmap(costmap_2d::Costmap2D const &costmap);
-    void distanceTransform(costmap_2d::Costmap2D const &costmap, Array2 &binary);
+    void getBinaryCostmap(costmap_2d::Costmap2D const &costmap, std::vector<uint8_t> &binary);
+    size_t distanceTransform(std::vector<uint8_t> const &binary);
 
     // Visualization
     void visualizeDistance(costmap_2d::Costmap2D const &costmap,
-                           Array2 const &distances);
+                           std::vector<float> const &distances);
 
     // BaseGlobalPlanner interface
     void initialize(std::string name, costmap_2d::Costmap2DROS* costmap_ros);
@@ -83,18 +130,104 @@ private:
     costmap_2d::Costmap2DROS *costmap_ros_;
     costmap_2d::Costmap2D costmap_;
     bool initialized_;
+    bool incremental_;
+    bool hierarchical_;
+    double hierarchical_distance_;
+    AnyAngle any_angle_;
+    bool geometry_changed_;
     double distance_max_;
+    double cost_weight_, distance_weight_;
+    size_t expansions_;
     unsigned int width_, height_;
-    unsigned int min_x_, max_x_;
-    unsigned int min_y_, max_y_;
     double resolution_;
+    double origin_x_, origin_y_;
+
+    // Raw costs of the costmap passed to the last setCostmap(). That costmap
+    // must outlive any plan made against it.
+    uint8_t const *raw_costs_;
+
+    // Obstacle mask, clearance, per-cell traversal cost and search scratch
+    // space. These are only reallocated when the size of the costmap changes.
+    // Traversal costs are at least one per meter, which keeps the octile
+    // heuristic admissible.
+    DistanceField distance_field_;
+    std::vector<uint8_t> binary_;
+    std::vector<float> cost_table_;
+    std::vector<float> cell_costs_;
+    std::vector<Node> path_;
+
+    // Cells around the robot that were unblocked to let it leave inflation.
+    std::vector<unsigned int> escape_;
+
+    // Search state is stored as parallel arrays. A cell's cost and parent
+    // are only valid if its stamp is at least generation_, so starting a new
+    // search just advances the generation instead of clearing every cell.
+    std::vector<float> cost_path_;
+    std::vector<unsigned int> parent_;
+    std::vector<uint16_t> stamp_;
+    uint16_t generation_;
+    IndexedHeap<float> fringe_;
+
+    // Distance from each column and row to the goal of the current search.
+    std::vector<unsigned int> heuristic_dx_, heuristic_dy_;
+    double heuristic_scale_;
+
+    // Search tree that persists between plans in incremental mode.
+    DStarLite dstar_;
+    std::vector<unsigned int> path_indices_;
+
+    // Abstract graph used for long-range plans.
+    HierarchicalPlanner hpa_;
 
     pcl_ros::Publisher<pcl::PointXYZI> pub_distances_;
     ros::Publisher pub_plan_;
+    ros::ServiceServer srv_make_plan_;
+
+    // Messages are only built when somebody is subscribed, and their buffers
+    // keep their capacity between plans.
+    pcl::PointCloud<pcl::PointXYZI> distance_cloud_;
+    nav_msgs::Path plan_msg_;
 
     double inscribed_radius_, circumscribed_radius_, inflation_radius_;
 
 private:
+    void buildCostTable(void);
+
+    /**
+     * Make the start cell and every inflated cell connected to it without
+     * crossing a lethal cell traversable at the highest finite cost.
+     */
+    void clearRobotCells(unsigned int start);
+    void startGeneration(void);
+    void checkLineOfSight(unsigned int index);
+
+    inline bool isVisited(unsigned int index) const
+    {
+        return stamp_[index] >= generation_;
+    }
+
+    inline bool isClosed(unsigned int index) const
+    {
+        return stamp_[index] == generation_ + 1;
+    }
+
+    inline float getCostPath(unsigned int index) const
+    {
+        return (isVisited(index)) ? cost_path_[index] : std::numeric_limits<float>::infinity();
+    }
+
+    inline double getHeuristic(unsigned int x, unsigned int y) const
+    {
+        unsigned int const dx = heuristic_dx_[x];
+        unsigned int const dy = heuristic_dy_[y];
+
+        if (any_angle_ == kAnyAngleTheta || any_angle_ == kAnyAngleLazy) {
+            return heuristic_scale_ * sqrt((double)dx * dx + (double)dy * dy);
+        } else {
+            return heuristic_scale_ * getOctileDistance(dx, dy);
+        }
+    }
+
     inline double sq_distance(geometry_msgs::PoseStamped const& p1,
                               geometry_msgs::PoseStamped const& p2)
     {
@@ -0,0 +1,108 @@
+#ifndef DISTANCE_TRANSFORM_H_
+#define DISTANCE_TRANSFORM_H_
+
+#include <stdint.h>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <navi_workers/worker_pool.h>
+
+namespace navi_astar {
+
+/**
+ * Exact Euclidean distance transform of a binary grid. This uses the
+ * separable two-pass algorithm of Meijster et al.: the first pass finds the
+ * distance to the nearest obstacle in each column with two linear scans and
+ * the second pass takes the lower envelope of parabolas along each row
+ * (Felzenszwalb and Huttenlocher). Both passes are O(N) and independent of
+ * the maximum distance.
+ *
+ * Scratch space is kept between calls, so reusing the same instance for
+ * every replan does not allocate.
+ */
+class DistanceTransform {
+public:
+    /**
+     * \param binary       row-major grid where non-zero cells are obstacles
+     * \param width        number of columns in the grid
+     * \param height       number of rows in the grid
+     * \param resolution   side length of one cell, in meters
+     * \param max_distance distances are clamped to this value, in meters
+     * \param distances    output distance to the nearest obstacle, in meters
+     */
+    void compute(uint8_t const *binary, unsigned int width, unsigned int height,
+                 double resolution, double max_distance, float *distances);
+
+private:
+    std::vector<float> row_;
+    std::vector<float> bounds_;
+    std::vector<int> vertices_;
+
+    void lowerEnvelope(float *row, unsigned int n);
+};
+
+/**
+ * Distance field that is split into square tiles and updated incrementally.
+ * The clamped distance of a cell only depends on obstacles within
+ * max_distance of it, so a tile only needs to be rebuilt when the obstacle
+ * mask changed inside the tile or within a max_distance margin around it.
+ * Each dirty tile is rebuilt by running DistanceTransform on the tile plus
+ * its margin, and dirty tiles are spread across a pool of threads.
+ */
+class DistanceField {
+public:
+    DistanceField(void);
+
+    /**
+     * \param threads number of threads to use; zero uses one per core
+     */
+    void setThreads(unsigned int threads);
+    void setTileSize(unsigned int tile_size);
+
+    /**
+     * Update the distance field to match a new obstacle mask. Everything is
+     * rebuilt if the geometry or maximum distance changed since the last
+     * call; otherwise only tiles near cells that changed are rebuilt.
+     *
+     * \return number of tiles that were rebuilt
+     */
+    size_t update(uint8_t const *binary, unsigned int width, unsigned int height,
+                  double resolution, double max_distance);
+
+    inline std::vector<float> const &getDistances(void) const
+    {
+        return distances_;
+    }
+
+private:
+    struct Worker {
+        DistanceTransform transform;
+        std::vector<uint8_t> binary;
+        std::vector<float> distances;
+    };
+
+    unsigned int threads_;
+    unsigned int tile_size_;
+    unsigned int width_, height_;
+    unsigned int tiles_x_, tiles_y_;
+    unsigned int margin_;
+    double resolution_, max_distance_;
+
+    std::vector<uint8_t> binary_;
+    std::vector<float> distances_;
+    std::vector<uint8_t> changed_;
+    std::vector<unsigned int> dirty_;
+    std::vector<Worker> workers_;
+    boost::scoped_ptr<navi_workers::WorkerPool> pool_;
+
+    boost::mutex mutex_;
+    size_t next_;
+
+    void markChangedTiles(uint8_t const *binary);
+    void work(int index);
+    void rebuildTile(unsigned int tile, Worker &worker);
+};
+
+};
+
+#endif
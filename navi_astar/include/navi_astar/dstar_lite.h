@@ -0,0 +1,97 @@
+#ifndef DSTAR_LITE_H_
+#define DSTAR_LITE_H_
+
+#include <vector>
+#include <navi_astar/indexed_heap.h>
+
+namespace navi_astar {
+
+/**
+ * Incremental grid search using D* Lite (Koenig and Likhachev). The search
+ * runs backwards from the goal, so the search tree stays valid as the robot
+ * moves and only the cells whose traversal cost changed between two plans
+ * need to be repaired.
+ *
+ * Cells are identified by their row-major index and edge costs are computed
+ * from a per-cell cost grid in the same way as AStarPlanner::getEdgeCost().
+ */
+class DStarLite {
+public:
+    static unsigned int const kNone;
+
+    DStarLite(void);
+
+    inline unsigned int getWidth(void) const { return width_; }
+    inline unsigned int getHeight(void) const { return height_; }
+    inline unsigned int getStart(void) const { return start_; }
+    inline unsigned int getGoal(void) const { return goal_; }
+
+    /**
+     * Discard the existing search tree and start a new search rooted at the
+     * goal. cell_costs is copied and used as the baseline for updateCosts().
+     */
+    void initialize(unsigned int width, unsigned int height, double resolution,
+                    std::vector<float> const &cell_costs,
+                    unsigned int start, unsigned int goal);
+
+    /**
+     * Move the start of the search without invalidating the search tree.
+     */
+    void setStart(unsigned int start);
+
+    /**
+     * Compare cell_costs with the costs used by the previous search and
+     * update the vertices that are adjacent to the cells that changed.
+     *
+     * \return number of cells whose cost changed
+     */
+    size_t updateCosts(std::vector<float> const &cell_costs);
+
+    /**
+     * Expand vertices until the start is locally consistent.
+     *
+     * \return true if there is a path from the start to the goal
+     */
+    bool computeShortestPath(void);
+
+    /**
+     * Follow the cost-to-goal gradient from the start to the goal.
+     *
+     * \return false if no path exists
+     */
+    bool getPath(std::vector<unsigned int> &path) const;
+
+    inline size_t getExpansions(void) const { return expansions_; }
+
+private:
+    struct Key {
+        float primary, secondary;
+
+        inline bool operator<(Key const &other) const
+        {
+            return primary < other.primary
+               || (primary == other.primary && secondary < other.secondary);
+        }
+    };
+
+    unsigned int width_, height_;
+    double resolution_;
+    unsigned int start_, goal_, last_;
+    float km_;
+    size_t expansions_;
+
+    std::vector<float> costs_;
+    std::vector<float> g_, rhs_;
+    std::vector<unsigned int> changed_;
+    IndexedHeap<Key> open_;
+
+    Key calculateKey(unsigned int index) const;
+    float getHeuristic(unsigned int from, unsigned int to) const;
+    float getEdgeCost(unsigned int from, unsigned int to, float length) const;
+    void updateVertex(unsigned int index);
+    void updateNeighbors(unsigned int index);
+};
+
+};
+
+#endif
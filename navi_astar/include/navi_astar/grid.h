@@ -0,0 +1,51 @@
+#ifndef GRID_H_
+#define GRID_H_
+
+#include <limits>
+
+namespace navi_astar {
+
+/**
+ * Moves between 8-connected grid cells shared by all of the planners. The
+ * four orthogonal moves come first, followed by the four diagonal moves.
+ * Lengths are in cells.
+ */
+static int const kMoves = 8;
+static int const kMoveX[kMoves] = { -1, +1,  0,  0, -1, +1, -1, +1 };
+static int const kMoveY[kMoves] = {  0,  0, -1, +1, -1, -1, +1, +1 };
+static float const kMoveLength[kMoves] = {
+    1.0f, 1.0f, 1.0f, 1.0f,
+    1.41421356f, 1.41421356f, 1.41421356f, 1.41421356f
+};
+
+/**
+ * Length of the shortest 8-connected path between two cells that are dx
+ * columns and dy rows apart, ignoring obstacles. Every cell costs at least
+ * one per unit length, so this is an admissible and consistent heuristic.
+ */
+inline float getOctileDistance(unsigned int dx, unsigned int dy)
+{
+    float const diagonal_extra = kMoveLength[kMoves - 1] - 1.0f;
+    return (dx > dy) ? dx + diagonal_extra * dy : dy + diagonal_extra * dx;
+}
+
+/**
+ * Diagonal moves are not allowed to cut the corner of an untraversable
+ * cell. Both orthogonal cells are in bounds whenever the destination is.
+ *
+ * \param costs per-cell traversal cost, infinite for obstacles
+ * \param width number of columns in the grid
+ */
+inline bool isCornerBlocked(float const *costs, unsigned int width, int x, int y, int move)
+{
+    float const infinity = std::numeric_limits<float>::infinity();
+    int const dx = kMoveX[move];
+    int const dy = kMoveY[move];
+
+    return dx != 0 && dy != 0
+        && (!(costs[y * width + x + dx] < infinity) || !(costs[(y + dy) * width + x] < infinity));
+}
+
+};
+
+#endif
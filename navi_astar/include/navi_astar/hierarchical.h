@@ -0,0 +1,136 @@
+#ifndef HIERARCHICAL_H_
+#define HIERARCHICAL_H_
+
+#include <stdint.h>
+#include <vector>
+#include <navi_astar/indexed_heap.h>
+
+namespace navi_astar {
+
+/**
+ * Hierarchical path-finding A* (HPA*, Botea et al.). The grid is divided
+ * into square clusters and every obstacle-free run of cells along the border
+ * between two clusters becomes an entrance. The cost of travelling between
+ * each pair of entrances inside a cluster is precomputed, so long-range
+ * queries search a small abstract graph and only refine the result on the
+ * fine grid one cluster at a time.
+ *
+ * Entrances and intra-cluster costs are only recomputed for clusters whose
+ * cells changed since the last call to update().
+ */
+class HierarchicalPlanner {
+public:
+    static unsigned int const kNone;
+
+    HierarchicalPlanner(void);
+
+    void setClusterSize(unsigned int cluster_size);
+
+    /**
+     * Refresh the abstract graph to match a new per-cell cost grid.
+     *
+     * \return number of clusters that were rebuilt
+     */
+    size_t update(unsigned int width, unsigned int height, double resolution,
+                  std::vector<float> const &cell_costs);
+
+    /**
+     * Find a path between two cells by searching the abstract graph and
+     * refining the result on the grid.
+     *
+     * \param path row-major indices of the cells from start to goal
+     * \return false if no path exists
+     */
+    bool search(unsigned int start, unsigned int goal, std::vector<unsigned int> &path);
+
+    inline size_t getAbstractSize(void) const { return node_cells_.size(); }
+
+private:
+    enum Side { kWest = 0, kEast, kSouth, kNorth, kSides };
+
+    // Pair of adjacent cells on either side of a cluster border. cell_a is
+    // in the west (or south) cluster and cell_b in the east (or north) one.
+    struct Transition {
+        unsigned int cell_a, cell_b;
+    };
+
+    struct Cluster {
+        unsigned int x0, y0, x1, y1;
+        unsigned int first[kSides];
+        std::vector<unsigned int> nodes;
+        std::vector<float> costs;
+    };
+
+    unsigned int cluster_size_;
+    unsigned int width_, height_;
+    unsigned int clusters_x_, clusters_y_;
+    double resolution_;
+
+    std::vector<float> costs_;
+    std::vector<Cluster> clusters_;
+    std::vector<uint8_t> dirty_;
+    std::vector<std::vector<Transition> > borders_x_;
+    std::vector<std::vector<Transition> > borders_y_;
+    std::vector<Transition> transitions_;
+
+    // Abstract graph, indexed by global node id.
+    std::vector<unsigned int> offsets_;
+    std::vector<unsigned int> node_cells_;
+    std::vector<unsigned int> node_clusters_;
+    std::vector<unsigned int> node_partners_;
+
+    // Scratch space for searches inside a single cluster.
+    std::vector<float> local_cost_;
+    std::vector<unsigned int> local_parent_;
+    std::vector<uint8_t> local_entrance_;
+    IndexedHeap<float> local_open_;
+
+    // Scratch space for searches on the abstract graph.
+    unsigned int start_, goal_;
+    std::vector<float> start_costs_, goal_costs_;
+    std::vector<float> abstract_cost_;
+    std::vector<unsigned int> abstract_parent_;
+    std::vector<unsigned int> abstract_path_;
+    IndexedHeap<float> abstract_open_;
+    std::vector<unsigned int> segment_;
+
+    inline unsigned int getClusterIndex(unsigned int cell) const
+    {
+        return ((cell / width_) / cluster_size_) * clusters_x_ + (cell % width_) / cluster_size_;
+    }
+
+    inline float getEdgeCost(unsigned int from, unsigned int to, float length) const
+    {
+        return 0.5f * (costs_[from] + costs_[to]) * length * resolution_;
+    }
+
+    float getHeuristic(unsigned int from, unsigned int to) const;
+
+    /**
+     * Recompute the transitions on one border.
+     *
+     * \return true if the transitions changed
+     */
+    bool buildBorderX(unsigned int cx, unsigned int cy);
+    bool buildBorderY(unsigned int cx, unsigned int cy);
+    bool addTransitions(std::vector<Transition> &border, unsigned int first_a,
+                        unsigned int stride, unsigned int offset_b, unsigned int length);
+    void buildCluster(unsigned int cx, unsigned int cy);
+    void linkClusters(void);
+
+    unsigned int getAbstractCell(unsigned int id) const;
+    void relaxAbstract(unsigned int from, unsigned int to, float cost);
+
+    /**
+     * Dijkstra search inside one cluster. Stops once target is settled or,
+     * if target is kNone, once all of the cluster's entrances are settled.
+     */
+    void searchCluster(Cluster const &cluster, unsigned int source, unsigned int target);
+    float getLocalCost(Cluster const &cluster, unsigned int cell) const;
+    bool appendLocalPath(Cluster const &cluster, unsigned int from, unsigned int to,
+                         std::vector<unsigned int> &path);
+};
+
+};
+
+#endif
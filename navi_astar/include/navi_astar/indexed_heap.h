@@ -0,0 +1,197 @@
+#ifndef INDEXED_HEAP_H_
+#define INDEXED_HEAP_H_
+
+#include <cassert>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+namespace navi_astar {
+
+/**
+ * Binary min-heap over a fixed universe of integer indices [0, n) that
+ * supports decrease-key. The position of every index is tracked in a flat
+ * array, so each index is in the heap at most once and updating its key is
+ * O(log n) instead of pushing a duplicate entry.
+ *
+ * Clearing the heap only touches the entries that are currently queued, so
+ * the same heap can be reused across searches without an O(n) reset.
+ */
+template <typename Key>
+class IndexedHeap {
+public:
+    static unsigned int const kNotQueued;
+
+    IndexedHeap(void)
+    {}
+
+    explicit IndexedHeap(unsigned int capacity)
+    {
+        resize(capacity);
+    }
+
+    void resize(unsigned int capacity)
+    {
+        clear();
+        position_.assign(capacity, kNotQueued);
+        heap_.reserve(capacity / 16);
+    }
+
+    void clear(void)
+    {
+        for (size_t i = 0; i < heap_.size(); ++i) {
+            position_[heap_[i].index] = kNotQueued;
+        }
+        heap_.clear();
+    }
+
+    inline bool empty(void) const
+    {
+        return heap_.empty();
+    }
+
+    inline size_t size(void) const
+    {
+        return heap_.size();
+    }
+
+    inline unsigned int capacity(void) const
+    {
+        return position_.size();
+    }
+
+    inline bool contains(unsigned int index) const
+    {
+        return position_[index] != kNotQueued;
+    }
+
+    inline unsigned int top(void) const
+    {
+        assert(!heap_.empty());
+        return heap_[0].index;
+    }
+
+    inline Key const &topKey(void) const
+    {
+        assert(!heap_.empty());
+        return heap_[0].key;
+    }
+
+    inline Key const &getKey(unsigned int index) const
+    {
+        assert(contains(index));
+        return heap_[position_[index]].key;
+    }
+
+    /**
+     * Insert index with the given key. If index is already queued, its key is
+     * replaced and the heap is repaired in whichever direction is necessary.
+     */
+    void push(unsigned int index, Key const &key)
+    {
+        unsigned int const pos = position_[index];
+
+        if (pos == kNotQueued) {
+            Entry const entry = { key, index };
+            heap_.push_back(entry);
+            position_[index] = heap_.size() - 1;
+            siftUp(heap_.size() - 1);
+        } else if (key < heap_[pos].key) {
+            heap_[pos].key = key;
+            siftUp(pos);
+        } else {
+            heap_[pos].key = key;
+            siftDown(pos);
+        }
+    }
+
+    unsigned int pop(void)
+    {
+        assert(!heap_.empty());
+        unsigned int const index = heap_[0].index;
+        removeAt(0);
+        return index;
+    }
+
+    void remove(unsigned int index)
+    {
+        unsigned int const pos = position_[index];
+        if (pos != kNotQueued) {
+            removeAt(pos);
+        }
+    }
+
+private:
+    struct Entry {
+        Key key;
+        unsigned int index;
+    };
+
+    std::vector<Entry> heap_;
+    std::vector<unsigned int> position_;
+
+    void removeAt(unsigned int pos)
+    {
+        unsigned int const last = heap_.size() - 1;
+        position_[heap_[pos].index] = kNotQueued;
+
+        if (pos != last) {
+            heap_[pos] = heap_[last];
+            position_[heap_[pos].index] = pos;
+            heap_.pop_back();
+
+            if (pos > 0 && heap_[pos].key < heap_[(pos - 1) / 2].key) {
+                siftUp(pos);
+            } else {
+                siftDown(pos);
+            }
+        } else {
+            heap_.pop_back();
+        }
+    }
+
+    void siftUp(unsigned int pos)
+    {
+        Entry const entry = heap_[pos];
+
+        while (pos > 0) {
+            unsigned int const parent = (pos - 1) / 2;
+            if (!(entry.key < heap_[parent].key)) break;
+
+            heap_[pos] = heap_[parent];
+            position_[heap_[pos].index] = pos;
+            pos = parent;
+        }
+        heap_[pos] = entry;
+        position_[entry.index] = pos;
+    }
+
+    void siftDown(unsigned int pos)
+    {
+        unsigned int const n = heap_.size();
+        Entry const entry = heap_[pos];
+
+        for (;;) {
+            unsigned int child = 2 * pos + 1;
+            if (child >= n) break;
+
+            if (child + 1 < n && heap_[child + 1].key < heap_[child].key) {
+                ++child;
+            }
+            if (!(heap_[child].key < entry.key)) break;
+
+            heap_[pos] = heap_[child];
+            position_[heap_[pos].index] = pos;
+            pos = child;
+        }
+        heap_[pos] = entry;
+        position_[entry.index] = pos;
+    }
+};
+
+template <typename Key>
+unsigned int const IndexedHeap<Key>::kNotQueued = std::numeric_limits<unsigned int>::max();
+
+};
+
+#endif
@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <limits>
 #include <pluginlib/class_list_macros.h>
 #include <navi_astar/astar.h>
 
@@ -7,7 +10,9 @@ PLUGINLIB_DECLARE_CLASS(navi_astar, AStarPlanner, navi_astar::AStarPlanner, nav_
 namespace navi_astar {
 
 uint8_t const AStarPlanner::kCostObstacle = 253;
+uint8_t const AStarPlanner::kCostLethal   = 254;
 uint8_t const AStarPlanner::kCostUnknown  = 255;
+unsigned int const AStarPlanner::kNoParent = std::numeric_limits<unsigned int>::max();
 
 /*
  * Node Datastructure
@@ -27,38 +32,58 @@ bool Node::operator!=(Node const &other) const
     return !(*this == other);
 }
 
-Predecessor::Predecessor(void)
-    : node(0, 0), initialized(false)
-{
-}
-
-Predecessor::Predecessor(Node node, double cost_path, double cost_heuristic)
-    : node(node)
-    , cost_path(cost_path)
-    , cost_heuristic(cost_heuristic)
-    , initialized(true)
-{
-}
-
-bool Predecessor::operator<(Predecessor const &other) const
-{
-    return cost_path + cost_heuristic < other.cost_path + other.cost_heuristic;
-}
-
 /*
  * A* Planner
  */
 
 AStarPlanner::AStarPlanner(void)
-    : initialized_(false)
+    : costmap_ros_(NULL)
+    , initialized_(false)
+    , incremental_(false)
+    , hierarchical_(false)
+    , hierarchical_distance_(20.0)
+    , any_angle_(kAnyAngleOff)
+    , geometry_changed_(true)
+    , distance_max_(2.0)
+    , cost_weight_(1.0)
+    , distance_weight_(0.5)
+    , expansions_(0)
+    , width_(0)
+    , height_(0)
+    , resolution_(0.0)
+    , origin_x_(0.0)
+    , origin_y_(0.0)
+    , raw_costs_(NULL)
+    , generation_(0)
+    , heuristic_scale_(0.0)
 {
     ROS_INFO("Constructed A* Planner");
+    buildCostTable();
 }
 
 AStarPlanner::AStarPlanner(std::string name, costmap_2d::Costmap2DROS *costmap_ros)
-    : initialized_(false)
+    : costmap_ros_(NULL)
+    , initialized_(false)
+    , incremental_(false)
+    , hierarchical_(false)
+    , hierarchical_distance_(20.0)
+    , any_angle_(kAnyAngleOff)
+    , geometry_changed_(true)
+    , distance_max_(2.0)
+    , cost_weight_(1.0)
+    , distance_weight_(0.5)
+    , expansions_(0)
+    , width_(0)
+    , height_(0)
+    , resolution_(0.0)
+    , origin_x_(0.0)
+    , origin_y_(0.0)
+    , raw_costs_(NULL)
+    , generation_(0)
+    , heuristic_scale_(0.0)
 {
     ROS_INFO("Constructed A* Planner");
+    buildCostTable();
     initialize(name, costmap_ros);
 }
 
@@ -69,154 +94,551 @@ void AStarPlanner::initialize(std::string name, costmap_2d::Costmap2DROS* costma
 {
     ros::NodeHandle nh_priv("~/" + name);
     pub_distances_.advertise(nh_priv, "distances", 1);
+    pub_plan_ = nh_priv.advertise<nav_msgs::Path>("plan", 1);
+    srv_make_plan_ = nh_priv.advertiseService("make_plan", &AStarPlanner::makePlanService, this);
     nh_priv.param("max_distance", distance_max_, 2.0);
+    nh_priv.param("cost_weight", cost_weight_, 1.0);
+    nh_priv.param("distance_weight", distance_weight_, 0.5);
+    buildCostTable();
+    nh_priv.param("incremental", incremental_, false);
+    nh_priv.param("hierarchical", hierarchical_, false);
+    nh_priv.param("hierarchical_distance", hierarchical_distance_, 20.0);
+
+    std::string any_angle;
+    nh_priv.param("any_angle", any_angle, std::string("off"));
+    if (any_angle == "smooth") {
+        any_angle_ = kAnyAngleSmooth;
+    } else if (any_angle == "theta") {
+        any_angle_ = kAnyAngleTheta;
+    } else if (any_angle == "lazy_theta") {
+        any_angle_ = kAnyAngleLazy;
+    } else {
+        if (any_angle != "off") {
+            ROS_WARN("Unknown any_angle mode \"%s\"; using grid paths.", any_angle.c_str());
+        }
+        any_angle_ = kAnyAngleOff;
+    }
+
+    int distance_threads, distance_tile_size;
+    nh_priv.param("distance_threads", distance_threads, 0);
+    nh_priv.param("distance_tile_size", distance_tile_size, 128);
+    distance_field_.setThreads(std::max(distance_threads, 0));
+    distance_field_.setTileSize(std::max(distance_tile_size, 1));
+
+    int cluster_size;
+    nh_priv.param("cluster_size", cluster_size, 32);
+    hpa_.setClusterSize(std::max(cluster_size, 2));
     costmap_ros_ = costmap_ros;
     initialized_ = true;
 
     ROS_INFO("Initialized A* Planner");
 }
 
-AStarPlanner::Array2Ptr AStarPlanner::getBinaryCostmap(costmap_2d::Costmap2D const &costmap)
+void AStarPlanner::buildCostTable(void)
 {
-    uint8_t const *raw = costmap.getCharMap();
-
-    Array2Ptr binary = boost::make_shared<Array2>(boost::extents[height_][width_]);
-
-    for (unsigned int y = 0; y < height_; ++y)
-    for (unsigned int x = 0; x < width_; ++x) {
-        uint8_t const cost = raw[y * height_ + x];
-
-        // Initialize the cell to be proportional to the distance from the
-        // obstacle.
-        if (cost == kCostUnknown || cost < kCostObstacle) {
-            (*binary)[y][x] = std::numeric_limits<uint8_t>::max();
-        } else {
-            (*binary)[y][x] = std::numeric_limits<uint8_t>::min();
+    // Map every costmap value to a traversal cost once instead of scaling
+    // each cell on every plan. Unknown cells are planned through as if they
+    // were free and obstacles are handled separately by the binary mask.
+    cost_table_.resize(256);
+
+    for (int cost = 0; cost < 256; ++cost) {
+        double weight = 0.0;
+        if (cost < kCostObstacle) {
+            weight = cost_weight_ * cost / (kCostObstacle - 1.0);
         }
+        cost_table_[cost] = 1.0 + weight;
     }
-    return binary;
 }
 
-void AStarPlanner::distanceTransform(costmap_2d::Costmap2D const &costmap, Array2 &binary)
+void AStarPlanner::getBinaryCostmap(costmap_2d::Costmap2D const &costmap,
+                                    std::vector<uint8_t> &binary)
 {
-    bool changed;
-    int iteration = 0;
-
-    int const max_iterations = static_cast<int>(ceil(distance_max_ / resolution_));
-
-    do {
-        changed = false;
+    uint8_t const *raw = costmap.getCharMap();
+    unsigned int const size = width_ * height_;
 
-        for (unsigned int y = min_y_; y < max_y_; ++y)
-        for (unsigned int x = min_x_; x < max_x_; ++x) {
-            uint8_t &value = binary[y][x];
-            unsigned int const value_old = value;
+    for (unsigned int i = 0; i < size; ++i) {
+        uint8_t const cost = raw[i];
+        binary[i] = cost != kCostUnknown && cost >= kCostObstacle;
+    }
+}
 
-            value = (uint8_t)std::min((unsigned int)value, binary[y - 1][x] + 1u);
-            value = (uint8_t)std::min((unsigned int)value, binary[y + 1][x] + 1u);
-            value = (uint8_t)std::min((unsigned int)value, binary[y][x - 1] + 1u);
-            value = (uint8_t)std::min((unsigned int)value, binary[y][x + 1] + 1u);
+size_t AStarPlanner::distanceTransform(std::vector<uint8_t> const &binary)
+{
+    if (binary.empty()) return 0;
 
-            // This is a fixed point algorithm that terminates when the costs
-            // stop changing.
-            changed = changed || (value < value_old);
-        }
-        iteration++;
-    } while (changed && iteration < max_iterations);
+    size_t const tiles = distance_field_.update(&binary[0], width_, height_,
+                                                resolution_, distance_max_);
+    ROS_DEBUG("A* rebuilt %d distance tiles", (int)tiles);
+    return tiles;
 }
 
 void AStarPlanner::visualizeDistance(costmap_2d::Costmap2D const &costmap,
-                                     Array2 const &distances)
+                                     std::vector<float> const &distances)
 {
+    if (pub_distances_.getNumSubscribers() == 0) return;
+
     double const origin_x = costmap.getOriginX();
     double const origin_y = costmap.getOriginY();
 
-    pcl::PointCloud<pcl::PointXYZI> cloud;
-    cloud.header.stamp = ros::Time::now();
-    cloud.header.frame_id = costmap_ros_->getGlobalFrameID();
+    // Reuse the points from the last plan; clearing keeps their capacity.
+    distance_cloud_.points.clear();
+    distance_cloud_.header.stamp = ros::Time::now();
+    distance_cloud_.header.frame_id = costmap_ros_->getGlobalFrameID();
 
-    for (unsigned int y = min_y_; y < max_y_; ++y)
-    for (unsigned int x = min_x_; x < max_x_; ++x) {
-        double const distance = distances[y][x] * resolution_;
+    // Cells beyond the maximum distance all have the same value, so only the
+    // region near obstacles is interesting.
+    pcl::PointXYZI pt;
+    pt.z = 0.0;
+
+    for (unsigned int y = 0; y < height_; ++y)
+    for (unsigned int x = 0; x < width_; ++x) {
+        float const distance = distances[y * width_ + x];
+        if (distance >= distance_max_) continue;
 
-        pcl::PointXYZI pt;
         pt.x = resolution_ * x + origin_x;
         pt.y = resolution_ * y + origin_y;
-        pt.z = 0.0;
         pt.intensity = distance;
-        cloud.push_back(pt);
+        distance_cloud_.points.push_back(pt);
     }
+    distance_cloud_.width  = distance_cloud_.points.size();
+    distance_cloud_.height = 1;
+
+    ROS_DEBUG("A* Published %d points.", (int)distance_cloud_.size());
+    pub_distances_.publish(distance_cloud_);
+}
 
-    ROS_INFO("A* Published %d points.", (int)cloud.size());
-    pub_distances_.publish(cloud);
+void AStarPlanner::setIncremental(bool incremental)
+{
+    incremental_ = incremental;
+}
+
+void AStarPlanner::setHierarchical(bool hierarchical, double distance)
+{
+    hierarchical_ = hierarchical;
+    hierarchical_distance_ = distance;
+}
+
+void AStarPlanner::setAnyAngle(AnyAngle any_angle)
+{
+    any_angle_ = any_angle;
 }
 
 /*
  * Plan
  */
-bool AStarPlanner::search(Node const &node_start, Node const &node_goal)
+void AStarPlanner::setCostmap(costmap_2d::Costmap2D const &costmap)
 {
-    BinaryArray visited(boost::extents[height_][width_]);
-    std::fill(visited.origin(), visited.origin() + visited.size(), false);
-
-    PredecessorArray predecessor(boost::extents[height_][width_]);
-    std::priority_queue<Predecessor> fringe;
-
-    double start_heuristic = getHeuristicValue(node_start, node_goal);
-    Predecessor predecessor_start(node_start, 0.0, start_heuristic);
-    fringe.push(predecessor_start);
-
-    while (!fringe.empty()) {
-        Predecessor const current = fringe.top();
-        Node const node = current.node;
-        fringe.pop();
-
-        ROS_INFO("Cost = %f", current.cost_path);
-
-        if (node == node_goal) {
-            ROS_INFO("Search Done");
-            break;
-        } else if (visited[node.y][node.x]) {
-            continue;
-        } else {
-            visited[node.y][node.x] = true;
+    unsigned int const width  = costmap.getSizeInCellsX();
+    unsigned int const height = costmap.getSizeInCellsY();
+    unsigned int const size   = width * height;
+    double const resolution = costmap.getResolution();
+    double const origin_x   = costmap.getOriginX();
+    double const origin_y   = costmap.getOriginY();
+
+    // Any search state that is kept between plans is only valid if the cells
+    // still cover the same part of the world. The flag stays set until a
+    // search rebuilds that state, since a plan may bail out before searching.
+    geometry_changed_ = geometry_changed_
+                     || width != width_ || height != height_ || resolution != resolution_
+                     || origin_x != origin_x_ || origin_y != origin_y_;
+    resolution_ = resolution;
+    origin_x_   = origin_x;
+    origin_y_   = origin_y;
+
+    // Only reallocate the scratch space when the map changes size.
+    if (width != width_ || height != height_) {
+        width_  = width;
+        height_ = height;
+        binary_.resize(size);
+        cell_costs_.resize(size);
+        cost_path_.resize(size);
+        parent_.resize(size);
+        stamp_.assign(size, 0);
+        generation_ = 0;
+        fringe_.resize(size);
+    }
+
+    getBinaryCostmap(costmap, binary_);
+    distanceTransform(binary_);
+
+    // Cells near obstacles cost more to traverse, in proportion to how much
+    // closer than max_distance they are. Combined with the costmap value
+    // this keeps plans away from obstacles where there is room to do so.
+    uint8_t const *raw = costmap.getCharMap();
+    raw_costs_ = raw;
+    std::vector<float> const &distances = distance_field_.getDistances();
+    float const infinity = std::numeric_limits<float>::infinity();
+    float const clearance_weight = distance_weight_;
+    float const clearance_scale  = (distance_max_ > 0.0) ? 1.0 / distance_max_ : 0.0;
+
+    for (unsigned int i = 0; i < size; ++i) {
+        float const clearance = clearance_weight * (1.0f - distances[i] * clearance_scale);
+        cell_costs_[i] = (binary_[i]) ? infinity : cost_table_[raw[i]] + clearance;
+    }
+}
+
+void AStarPlanner::clearRobotCells(unsigned int start)
+{
+    // Flood out from the robot through the inscribed band. Every cell that
+    // can be reached without crossing a lethal cell becomes traversable at
+    // the highest finite cost, so there is always a way out of inflation.
+    uint8_t const *raw = raw_costs_;
+    float const infinity = std::numeric_limits<float>::infinity();
+    float const cost_escape = cost_table_[kCostObstacle - 1];
+
+    escape_.clear();
+    escape_.push_back(start);
+    cell_costs_[start] = cost_escape;
+
+    for (size_t i = 0; i < escape_.size(); ++i) {
+        Node const node = getNode(escape_[i]);
+
+        // Orthogonal moves are enough; diagonal moves could not cut between
+        // two blocked cells anyway.
+        for (int j = 0; j < 4; ++j) {
+            int const x = (int)node.x + kMoveX[j];
+            int const y = (int)node.y + kMoveY[j];
+            if (!isInBounds(x, y)) continue;
+
+            unsigned int const neighbor = y * width_ + x;
+            if (cell_costs_[neighbor] < infinity || raw[neighbor] == kCostLethal) continue;
+
+            cell_costs_[neighbor] = cost_escape;
+            escape_.push_back(neighbor);
         }
+    }
+    ROS_DEBUG("A* unblocked %d inflated cells around the robot", (int)escape_.size());
+}
 
-        if (node.x > 0)
-            fringe.push(getPredecessor(current, node_goal, -1,  0));
-        if (node.x < width_ - 1)
-            fringe.push(getPredecessor(current, node_goal, +1,  0));
-        if (node.y > 0)
-            fringe.push(getPredecessor(current, node_goal,  0, -1));
-        if (node.y < height_ - 1)
-            fringe.push(getPredecessor(current, node_goal, -1, +1));
+bool AStarPlanner::search(Node const &node_start, Node const &node_goal)
+{
+    unsigned int const start = getIndex(node_start);
+    unsigned int const goal  = getIndex(node_goal);
+    float const infinity = std::numeric_limits<float>::infinity();
+
+    startGeneration();
+    fringe_.clear();
+
+    // The heuristic only depends on the column and row offsets to the goal,
+    // so they are tabulated once per search. Inflating the heuristic by a
+    // factor just above one breaks ties between equal f values in favour of
+    // nodes closer to the goal, and costs at most that factor in path cost.
+    heuristic_dx_.resize(width_);
+    heuristic_dy_.resize(height_);
+    for (unsigned int x = 0; x < width_; ++x) {
+        heuristic_dx_[x] = (x > node_goal.x) ? x - node_goal.x : node_goal.x - x;
+    }
+    for (unsigned int y = 0; y < height_; ++y) {
+        heuristic_dy_[y] = (y > node_goal.y) ? y - node_goal.y : node_goal.y - y;
+    }
+    heuristic_scale_ = resolution_ * (1.0 + 1.0 / (width_ + height_));
+
+    cost_path_[start] = 0.0f;
+    parent_[start]    = kNoParent;
+    stamp_[start]     = generation_;
+    fringe_.push(start, getHeuristic(node_start.x, node_start.y));
+    expansions_ = 0;
+
+    while (!fringe_.empty()) {
+        unsigned int const index = fringe_.pop();
+        ++expansions_;
+        if (any_angle_ == kAnyAngleLazy) {
+            checkLineOfSight(index);
+        }
+        if (index == goal) {
+            return true;
+        }
+        stamp_[index] = generation_ + 1;
+
+        Node const node = getNode(index);
+        unsigned int const parent = parent_[index];
+
+        for (int i = 0; i < kMoves; ++i) {
+            int const x = node.x + kMoveX[i];
+            int const y = node.y + kMoveY[i];
+            if (!isInBounds(x, y)) continue;
+
+            unsigned int const neighbor = y * width_ + x;
+            if (isClosed(neighbor) || !(cell_costs_[neighbor] < infinity)) continue;
+            if (isCornerBlocked(&cell_costs_[0], width_, node.x, node.y, i)) continue;
+
+            unsigned int from = index;
+            float cost_path = cost_path_[index] + getEdgeCost(index, neighbor, kMoveLength[i]);
+
+            // Any-angle searches try to connect the neighbor directly to the
+            // parent of the expanded node. Lazy Theta* optimistically uses the
+            // straight-line cost and defers the line of sight check.
+            if ((any_angle_ == kAnyAngleTheta || any_angle_ == kAnyAngleLazy) && parent != kNoParent) {
+                double cost_line;
+                if (any_angle_ == kAnyAngleLazy) {
+                    Node const node_parent = getNode(parent);
+                    double const dx = (double)node_parent.x - x;
+                    double const dy = (double)node_parent.y - y;
+                    cost_line = getEdgeCost(parent, neighbor, sqrt(dx * dx + dy * dy));
+                } else {
+                    cost_line = getLineCost(parent, neighbor);
+                }
+
+                if (cost_path_[parent] + cost_line <= cost_path) {
+                    from      = parent;
+                    cost_path = cost_path_[parent] + cost_line;
+                }
+            }
+
+            if (cost_path < getCostPath(neighbor)) {
+                double const cost_heuristic = getHeuristic(x, y);
+                cost_path_[neighbor] = cost_path;
+                parent_[neighbor]    = from;
+                stamp_[neighbor]     = generation_;
+                fringe_.push(neighbor, cost_path + cost_heuristic);
+            }
+        }
     }
     return false;
 }
 
-Predecessor AStarPlanner::getPredecessor(Predecessor const &curr, Node const &goal,
-                                         int dx, int dy)
+void AStarPlanner::startGeneration(void)
+{
+    // Each search uses two stamps: one for open cells and one for closed
+    // cells. Only when the counter wraps around do the stamps need to be
+    // cleared.
+    if (generation_ >= std::numeric_limits<uint16_t>::max() - 2) {
+        std::fill(stamp_.begin(), stamp_.end(), 0);
+        generation_ = 0;
+    }
+    generation_ += 2;
+}
+
+void AStarPlanner::checkLineOfSight(unsigned int index)
 {
-    Node const node(curr.node.x + dx, curr.node.y + dy);
+    unsigned int const parent = parent_[index];
+    if (parent == kNoParent) return;
+
+    double const cost_line = getLineCost(parent, index);
+    if (cost_line < std::numeric_limits<double>::infinity()) {
+        cost_path_[index] = cost_path_[parent] + cost_line;
+        return;
+    }
 
-    // TODO: Use the weighted costs in this calculation.
-    double const new_cost_path = curr.cost_path + 1.0;
-    double const new_cost_heuristic = getHeuristicValue(curr.node, goal);
+    // No line of sight: fall back to the best expanded neighbor. There is
+    // always at least one, since this node was queued from one of them.
+    Node const node = getNode(index);
+    cost_path_[index] = std::numeric_limits<float>::infinity();
 
-    return Predecessor(node, new_cost_path, new_cost_heuristic);
+    for (int i = 0; i < kMoves; ++i) {
+        int const x = node.x + kMoveX[i];
+        int const y = node.y + kMoveY[i];
+        if (!isInBounds(x, y)) continue;
+
+        unsigned int const neighbor = y * width_ + x;
+        if (!isClosed(neighbor)) continue;
+        if (isCornerBlocked(&cell_costs_[0], width_, node.x, node.y, i)) continue;
+
+        float const cost_path = cost_path_[neighbor] + getEdgeCost(neighbor, index, kMoveLength[i]);
+        if (cost_path < cost_path_[index]) {
+            cost_path_[index] = cost_path;
+            parent_[index]    = neighbor;
+        }
+    }
 }
 
-Node AStarPlanner::getNode(double world_x, double world_y)
+double AStarPlanner::getLineCost(unsigned int from, unsigned int to) const
 {
-    Node node(0, 0);
-    // TODO: Check if it's in bounds.
-    costmap_.worldToMap(world_x, world_y, node.x, node.y);
-    return node;
+    float const infinity = std::numeric_limits<float>::infinity();
+    int x = from % width_;
+    int y = from / width_;
+    int const x1 = to % width_;
+    int const y1 = to / width_;
+    int const dx = std::abs(x1 - x);
+    int const dy = std::abs(y1 - y);
+    int const sx = (x < x1) ? 1 : -1;
+    int const sy = (y < y1) ? 1 : -1;
+    int error = dx - dy;
+
+    // The cost of the line is its length weighted by the mean cost of the
+    // cells it crosses, which matches getEdgeCost() for neighboring cells.
+    double cost_sum = cell_costs_[from];
+    unsigned int cells = 1;
+
+    while (x != x1 || y != y1) {
+        int const error2 = 2 * error;
+        bool const step_x = error2 > -dy;
+        bool const step_y = error2 < dx;
+
+        if (step_x && step_y) {
+            if (!(cell_costs_[y * width_ + x + sx] < infinity)
+             || !(cell_costs_[(y + sy) * width_ + x] < infinity)) {
+                return std::numeric_limits<double>::infinity();
+            }
+        }
+        if (step_x) {
+            error -= dy;
+            x += sx;
+        }
+        if (step_y) {
+            error += dx;
+            y += sy;
+        }
+
+        float const cost = cell_costs_[y * width_ + x];
+        if (!(cost < infinity)) {
+            return std::numeric_limits<double>::infinity();
+        }
+        cost_sum += cost;
+        ++cells;
+    }
+    return (cost_sum / cells) * sqrt((double)(dx * dx + dy * dy)) * resolution_;
+}
+
+void AStarPlanner::smoothPath(std::vector<Node> &path) const
+{
+    if (path.size() < 3) return;
+
+    // Greedily skip waypoints as long as the straight line from the last
+    // waypoint that was kept is no more expensive than the grid path.
+    size_t anchor = 0;
+    size_t kept   = 1;
+    double cost_grid = 0.0;
+
+    for (size_t i = 0; i + 1 < path.size(); ++i) {
+        unsigned int const curr = getIndex(path[i]);
+        unsigned int const next = getIndex(path[i + 1]);
+        double const length = (path[i].x != path[i + 1].x && path[i].y != path[i + 1].y)
+                            ? M_SQRT2 : 1.0;
+        cost_grid += getEdgeCost(curr, next, length);
+
+        if (i == anchor) continue;
+
+        double const cost_line = getLineCost(getIndex(path[anchor]), next);
+        if (!(cost_line <= cost_grid * (1.0 + 1e-6))) {
+            path[kept++] = path[i];
+            anchor    = i;
+            cost_grid = getEdgeCost(curr, next, length);
+        }
+    }
+    path[kept++] = path.back();
+    path.resize(kept, path.back());
+}
+
+bool AStarPlanner::searchIncremental(Node const &node_start, Node const &node_goal)
+{
+    unsigned int const start = getIndex(node_start);
+    unsigned int const goal  = getIndex(node_goal);
+
+    // The search tree is rooted at the goal, so it must be rebuilt whenever
+    // the goal moves. Otherwise only the cells that changed are repaired.
+    if (geometry_changed_ || dstar_.getGoal() != goal) {
+        dstar_.initialize(width_, height_, resolution_, cell_costs_, start, goal);
+    } else {
+        dstar_.setStart(start);
+        size_t const changed = dstar_.updateCosts(cell_costs_);
+        ROS_DEBUG("D* Lite repairing %d changed cells", (int)changed);
+    }
+    geometry_changed_ = false;
+
+    bool const found = dstar_.computeShortestPath();
+    expansions_ = dstar_.getExpansions();
+    ROS_DEBUG("D* Lite expanded %d vertices", (int)expansions_);
+    if (!found || !dstar_.getPath(path_indices_)) {
+        return false;
+    }
+
+    path_.clear();
+    for (size_t i = 0; i < path_indices_.size(); ++i) {
+        path_.push_back(getNode(path_indices_[i]));
+    }
+    return true;
+}
+
+bool AStarPlanner::searchHierarchical(Node const &node_start, Node const &node_goal)
+{
+    // Only clusters containing cells that changed since the last long-range
+    // plan have their entrances and intra-cluster costs recomputed.
+    size_t const clusters = hpa_.update(width_, height_, resolution_, cell_costs_);
+    ROS_DEBUG("HPA* rebuilt %d clusters, %d abstract nodes",
+              (int)clusters, (int)hpa_.getAbstractSize());
+
+    if (!hpa_.search(getIndex(node_start), getIndex(node_goal), path_indices_)) {
+        return false;
+    }
+
+    path_.clear();
+    for (size_t i = 0; i < path_indices_.size(); ++i) {
+        path_.push_back(getNode(path_indices_[i]));
+    }
+    return true;
+}
+
+void AStarPlanner::getPath(Node const &node_goal, std::vector<Node> &path)
+{
+    path.clear();
+
+    for (unsigned int index = getIndex(node_goal); index != kNoParent; index = parent_[index]) {
+        path.push_back(getNode(index));
+    }
+    std::reverse(path.begin(), path.end());
+}
+
+bool AStarPlanner::findPath(Node const &node_start, Node const &node_goal, bool far)
+{
+    // A goal inside an obstacle can never be reached, so don't bother
+    // searching the whole map to find that out.
+    float const infinity = std::numeric_limits<float>::infinity();
+    unsigned int const index_start = getIndex(node_start);
+    unsigned int const index_goal  = getIndex(node_goal);
+
+    if (!(cell_costs_[index_goal] < infinity)) {
+        ROS_ERROR_THROTTLE(10, "Goal is inside an obstacle.");
+        return false;
+    }
+
+    // The robot may have drifted into the inflated obstacle band, which would
+    // block every edge out of its cell. Like navfn, always let the robot leave.
+    if (!(cell_costs_[index_start] < infinity)) {
+        clearRobotCells(index_start);
+    }
+
+    // Theta* searches directly produce any-angle paths; grid paths are
+    // smoothed after the fact instead.
+    bool found;
+    bool grid_path = true;
+
+    if (incremental_) {
+        found = searchIncremental(node_start, node_goal);
+    } else if (hierarchical_ && far) {
+        found = searchHierarchical(node_start, node_goal);
+    } else {
+        found = search(node_start, node_goal);
+        grid_path = any_angle_ != kAnyAngleTheta && any_angle_ != kAnyAngleLazy;
+        if (found) {
+            getPath(node_goal, path_);
+        }
+    }
+
+    if (!found) {
+        ROS_WARN_THROTTLE(10, "A* was unable to find a path to the goal.");
+        return false;
+    } else if (grid_path && any_angle_ != kAnyAngleOff) {
+        smoothPath(path_);
+    }
+    return true;
+}
+
+bool AStarPlanner::getNode(double world_x, double world_y, Node &node)
+{
+    return costmap_.worldToMap(world_x, world_y, node.x, node.y);
 }
 
 double AStarPlanner::getHeuristicValue(Node const &node, Node const &goal)
 {
-    return resolution_ * sqrt(pow(node.x - goal.x, 2) + pow(node.y - goal.y, 2));
+    int const dx = (int)node.x - (int)goal.x;
+    int const dy = (int)node.y - (int)goal.y;
+
+    if (any_angle_ == kAnyAngleTheta || any_angle_ == kAnyAngleLazy) {
+        return resolution_ * sqrt((double)dx * dx + (double)dy * dy);
+    } else {
+        return resolution_ * getOctileDistance(std::abs(dx), std::abs(dy));
+    }
 }
 
 /*
@@ -226,48 +648,74 @@ bool AStarPlanner::makePlan(geometry_msgs::PoseStamped const &start,
                             geometry_msgs::PoseStamped const &goal,
                             std::vector<geometry_msgs::PoseStamped> &plan)
 {
-    ROS_INFO("A* Make Plan");
+    plan.clear();
+
+    if (!initialized_) {
+        ROS_ERROR("A* planner has not been initialized.");
+        return false;
+    }
+
     costmap_ros_->getCostmapCopy(costmap_);
-    width_  = costmap_.getSizeInCellsX();
-    height_ = costmap_.getSizeInCellsY();
-    resolution_ = costmap_.getResolution();
-    
-    geometry_msgs::Point position = start.pose.position;
-    unsigned int start_x, start_y;
-    bool in_bounds = costmap_.worldToMap(position.x, position.y,start_x, start_y);
-    if (!in_bounds) {
+    setCostmap(costmap_);
+
+    geometry_msgs::Point const position_start = start.pose.position;
+    geometry_msgs::Point const position_goal  = goal.pose.position;
+    Node node_start(0, 0), node_goal(0, 0);
+
+    if (!getNode(position_start.x, position_start.y, node_start)) {
         ROS_ERROR_THROTTLE(10, "Robot is outside the global costmap.");
         return false;
+    } else if (!getNode(position_goal.x, position_goal.y, node_goal)) {
+        ROS_ERROR_THROTTLE(10, "Goal is outside the global costmap.");
+        return false;
     }
 
-    min_x_ = std::max(start_x - 20, 0u);
-    max_x_ = std::min(start_x + 20, width_);
-    min_y_ = std::max(start_y - 20, 0u);
-    max_y_ = std::min(start_y + 20, height_);
+    // The hierarchical search is slightly suboptimal, so it is only used for
+    // goals that are far enough away for a flat search to be too slow.
+    bool const far = sq_distance(start, goal) >= hierarchical_distance_ * hierarchical_distance_;
+
+    if (!findPath(node_start, node_goal, far)) return false;
 
-    ROS_INFO("%d %d %d %d", min_x_, max_x_, min_y_, max_y_);
+    // Convert the path from grid coordinates into poses in the global frame.
+    plan.reserve(path_.size());
 
-    Array2Ptr distances = getBinaryCostmap(costmap_);
-    distanceTransform(costmap_, *distances);
+    geometry_msgs::PoseStamped pose;
+    pose.header.stamp    = ros::Time::now();
+    pose.header.frame_id = costmap_ros_->getGlobalFrameID();
+    pose.pose.orientation.w = 1.0;
 
-    geometry_msgs::Point position_start = start.pose.position;
-    geometry_msgs::Point position_goal = goal.pose.position;
-    Node const node_start = getNode(position_start.x, position_start.y);
-    Node const node_goal = getNode(position_goal.x, position_goal.y);
-    search(node_start, node_goal);
+    for (size_t i = 0; i < path_.size(); ++i) {
+        costmap_.mapToWorld(path_[i].x, path_[i].y, pose.pose.position.x, pose.pose.position.y);
+        plan.push_back(pose);
+    }
+    plan.back().pose = goal.pose;
 
-    visualizeDistance(costmap_, *distances);
+    publishPlan(plan, 0.0, 1.0, 0.0, 0.0);
+    visualizeDistance(costmap_, distance_field_.getDistances());
     return true;
 }
 
 void AStarPlanner::publishPlan(std::vector<geometry_msgs::PoseStamped> const& path,
                                double r, double g, double b, double a)
 {
-    
+    // The path message is a full copy of the plan, so only build it when
+    // somebody is listening. The colour is ignored, as in NavfnROS.
+    if (path.empty() || pub_plan_.getNumSubscribers() == 0) return;
+
+    plan_msg_.header = path.front().header;
+    plan_msg_.poses.assign(path.begin(), path.end());
+    pub_plan_.publish(plan_msg_);
 }
 
 bool AStarPlanner::makePlanService(nav_msgs::GetPlan::Request &req, nav_msgs::GetPlan::Response &resp)
 {
+    // Plan directly into the response to avoid copying the poses.
+    makePlan(req.start, req.goal, resp.plan.poses);
+
+    resp.plan.header.stamp = ros::Time::now();
+    if (costmap_ros_ != NULL) {
+        resp.plan.header.frame_id = costmap_ros_->getGlobalFrameID();
+    }
     return true;
 }
 
@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <ros/time.h>
+#include <costmap_2d/cost_values.h>
+#include <navi_astar/astar.h>
+
+/*
+ * Offline benchmark for AStarPlanner. Each image is loaded as a costmap
+ * using the same convention as map_server: dark pixels are occupied and
+ * light pixels are free. Random start and goal cells are then planned
+ * between with each search mode, toggling a few obstacles between plans,
+ * and the latency of findPath() and setCostmap() is reported.
+ */
+using navi_astar::AStarPlanner;
+using navi_astar::Node;
+
+struct Options {
+    double resolution;
+    double scale;
+    double occupied_thresh;
+    double free_thresh;
+    bool negate;
+    int queries;
+    int changes;
+    int repeat;
+    unsigned int seed;
+    std::vector<std::string> modes;
+    std::vector<std::string> paths;
+};
+
+static char const *const kModes[] = {
+    "astar", "smooth", "theta", "lazy_theta", "incremental", "hierarchical"
+};
+static int const kNumModes = sizeof(kModes) / sizeof(kModes[0]);
+
+struct Stats {
+    double mean, p50, p90, p99, max;
+};
+
+static Stats getStats(std::vector<double> samples)
+{
+    Stats stats = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+    if (samples.empty()) return stats;
+
+    std::sort(samples.begin(), samples.end());
+    size_t const n = samples.size();
+
+    for (size_t i = 0; i < n; ++i) {
+        stats.mean += samples[i];
+    }
+    stats.mean /= n;
+    stats.p50 = samples[(n - 1) * 50 / 100];
+    stats.p90 = samples[(n - 1) * 90 / 100];
+    stats.p99 = samples[(n - 1) * 99 / 100];
+    stats.max = samples[n - 1];
+    return stats;
+}
+
+static void printStats(char const *name, char const *units, std::vector<double> const &samples)
+{
+    Stats const stats = getStats(samples);
+    printf("  %-22s mean %10.2f  p50 %10.2f  p90 %10.2f  p99 %10.2f  max %10.2f %s\n",
+           name, stats.mean, stats.p50, stats.p90, stats.p99, stats.max, units);
+}
+
+static long getPeakMemory(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static bool loadCostmap(std::string const &path, Options const &options,
+                        costmap_2d::Costmap2D &costmap, std::vector<unsigned int> &free_cells)
+{
+    cv::Mat image = cv::imread(path, 0);
+    if (image.empty()) {
+        fprintf(stderr, "error: unable to load '%s'\n", path.c_str());
+        return false;
+    }
+
+    if (options.scale != 1.0) {
+        cv::Mat scaled;
+        cv::resize(image, scaled, cv::Size(), options.scale, options.scale, cv::INTER_AREA);
+        image = scaled;
+    }
+
+    unsigned int const width  = image.cols;
+    unsigned int const height = image.rows;
+    costmap = costmap_2d::Costmap2D(width, height, options.resolution, 0.0, 0.0);
+    free_cells.clear();
+
+    // Image rows run top to bottom, but costmap rows run bottom to top.
+    for (unsigned int y = 0; y < height; ++y) {
+        uint8_t const *row = image.ptr<uint8_t>(height - y - 1);
+
+        for (unsigned int x = 0; x < width; ++x) {
+            double const value = row[x] / 255.0;
+            double const occupied = (options.negate) ? value : 1.0 - value;
+            unsigned char cost;
+
+            if (occupied > options.occupied_thresh) {
+                cost = costmap_2d::LETHAL_OBSTACLE;
+            } else if (occupied < options.free_thresh) {
+                cost = costmap_2d::FREE_SPACE;
+                free_cells.push_back(y * width + x);
+            } else {
+                cost = costmap_2d::NO_INFORMATION;
+            }
+            costmap.setCost(x, y, cost);
+        }
+    }
+    return true;
+}
+
+static bool isMode(std::string const &mode)
+{
+    return std::find(kModes, kModes + kNumModes, mode) != kModes + kNumModes;
+}
+
+static void setMode(AStarPlanner &planner, std::string const &mode)
+{
+    // Hierarchical mode is used for every query, no matter how close.
+    planner.setIncremental(mode == "incremental");
+    planner.setHierarchical(mode == "hierarchical", 0.0);
+
+    if (mode == "smooth") {
+        planner.setAnyAngle(AStarPlanner::kAnyAngleSmooth);
+    } else if (mode == "theta") {
+        planner.setAnyAngle(AStarPlanner::kAnyAngleTheta);
+    } else if (mode == "lazy_theta") {
+        planner.setAnyAngle(AStarPlanner::kAnyAngleLazy);
+    } else {
+        planner.setAnyAngle(AStarPlanner::kAnyAngleOff);
+    }
+}
+
+static Node getFreeNode(costmap_2d::Costmap2D const &costmap,
+                        std::vector<unsigned int> const &free_cells)
+{
+    // Toggled cells may have turned some of the free cells into obstacles.
+    unsigned int const width = costmap.getSizeInCellsX();
+    Node node(0, 0);
+
+    for (int i = 0; i < 100; ++i) {
+        unsigned int const cell = free_cells[rand() % free_cells.size()];
+        node = Node(cell % width, cell / width);
+        if (costmap.getCost(node.x, node.y) != costmap_2d::LETHAL_OBSTACLE) break;
+    }
+    return node;
+}
+
+static void benchmarkMode(costmap_2d::Costmap2D costmap, std::vector<unsigned int> const &free_cells,
+                          std::string const &mode, Options const &options)
+{
+    unsigned int const width  = costmap.getSizeInCellsX();
+    unsigned int const height = costmap.getSizeInCellsY();
+
+    // Every mode sees the same queries and the same changes to the map.
+    srand(options.seed);
+
+    AStarPlanner planner;
+    setMode(planner, mode);
+
+    ros::WallTime const time_setup = ros::WallTime::now();
+    planner.setCostmap(costmap);
+    double const duration_setup = (ros::WallTime::now() - time_setup).toSec() * 1e3;
+
+    std::vector<double> latency_search, latency_update, expansions, lengths;
+    Node node_goal(0, 0);
+    int found = 0;
+
+    for (int i = 0; i < options.queries; ++i) {
+        // Keeping the goal for a few queries lets the incremental search
+        // repair its tree instead of starting over.
+        if (i % options.repeat == 0) {
+            node_goal = getFreeNode(costmap, free_cells);
+        }
+        Node const node_start = getFreeNode(costmap, free_cells);
+
+        ros::WallTime const time_search = ros::WallTime::now();
+        bool const success = planner.findPath(node_start, node_goal, true);
+        latency_search.push_back((ros::WallTime::now() - time_search).toSec() * 1e3);
+
+        // The hierarchical search does not count its expansions.
+        if (mode != "hierarchical") {
+            expansions.push_back(planner.getExpansions());
+        }
+
+        if (success) {
+            lengths.push_back(planner.getLastPath().size());
+            ++found;
+        }
+
+        // Simulate new sensor data by toggling a few obstacles, then rebuild
+        // the cell costs and distance field the next search runs against.
+        for (int j = 0; j < options.changes; ++j) {
+            unsigned int const cell = rand() % (width * height);
+            unsigned int const x = cell % width;
+            unsigned int const y = cell / width;
+            bool const lethal = costmap.getCost(x, y) == costmap_2d::LETHAL_OBSTACLE;
+            costmap.setCost(x, y, (lethal) ? costmap_2d::FREE_SPACE : costmap_2d::LETHAL_OBSTACLE);
+        }
+
+        ros::WallTime const time_update = ros::WallTime::now();
+        planner.setCostmap(costmap);
+        latency_update.push_back((ros::WallTime::now() - time_update).toSec() * 1e3);
+    }
+
+    printf(" %s\n", mode.c_str());
+    printf("  setCostmap             %10.2f ms (full distance transform)\n", duration_setup);
+    printf("  paths found            %10d / %d\n", found, options.queries);
+    printStats("findPath", "ms", latency_search);
+    printStats("expanded nodes", "", expansions);
+    printStats("path waypoints", "", lengths);
+    printStats("setCostmap (churn)", "ms", latency_update);
+}
+
+static void benchmark(std::string const &path, Options const &options)
+{
+    costmap_2d::Costmap2D costmap;
+    std::vector<unsigned int> free_cells;
+
+    if (!loadCostmap(path, options, costmap, free_cells)) {
+        return;
+    } else if (free_cells.empty()) {
+        fprintf(stderr, "error: '%s' has no free cells\n", path.c_str());
+        return;
+    }
+
+    unsigned int const width  = costmap.getSizeInCellsX();
+    unsigned int const height = costmap.getSizeInCellsY();
+    printf("%s: %ux%u cells, %u free\n", path.c_str(), width, height,
+           (unsigned int)free_cells.size());
+
+    for (size_t i = 0; i < options.modes.size(); ++i) {
+        benchmarkMode(costmap, free_cells, options.modes[i], options);
+    }
+    printf("  peak memory            %10ld kB\n", getPeakMemory());
+}
+
+static void usage(char const *name)
+{
+    fprintf(stderr,
+        "usage: %s [options] image...\n"
+        "  --resolution R  cell size in meters (default 0.05)\n"
+        "  --scale S       resize images by S before planning (default 1.0)\n"
+        "  --occupied P    occupancy above P is an obstacle (default 0.65)\n"
+        "  --free P        occupancy below P is free (default 0.196)\n"
+        "  --negate        treat light pixels as occupied\n"
+        "  --queries N     random start/goal pairs per image (default 100)\n"
+        "  --changes N     cells toggled before each costmap update (default 10)\n"
+        "  --repeat N      queries that share each goal (default 1)\n"
+        "  --mode M        astar, smooth, theta, lazy_theta, incremental, hierarchical\n"
+        "                  or all; may be repeated (default all)\n"
+        "  --seed N        random seed (default 0)\n",
+        name);
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    options.resolution      = 0.05;
+    options.scale           = 1.0;
+    options.occupied_thresh = 0.65;
+    options.free_thresh     = 0.196;
+    options.negate          = false;
+    options.queries         = 100;
+    options.changes         = 10;
+    options.repeat          = 1;
+    options.seed            = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string const arg = argv[i];
+        bool const has_value = i + 1 < argc;
+
+        if (arg == "--resolution" && has_value) {
+            options.resolution = atof(argv[++i]);
+        } else if (arg == "--scale" && has_value) {
+            options.scale = atof(argv[++i]);
+        } else if (arg == "--occupied" && has_value) {
+            options.occupied_thresh = atof(argv[++i]);
+        } else if (arg == "--free" && has_value) {
+            options.free_thresh = atof(argv[++i]);
+        } else if (arg == "--negate") {
+            options.negate = true;
+        } else if (arg == "--queries" && has_value) {
+            options.queries = atoi(argv[++i]);
+        } else if (arg == "--changes" && has_value) {
+            options.changes = atoi(argv[++i]);
+        } else if (arg == "--repeat" && has_value) {
+            options.repeat = atoi(argv[++i]);
+        } else if (arg == "--mode" && has_value) {
+            std::string const mode = argv[++i];
+            if (mode == "all") {
+                options.modes.insert(options.modes.end(), kModes, kModes + kNumModes);
+            } else if (isMode(mode)) {
+                options.modes.push_back(mode);
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--seed" && has_value) {
+            options.seed = atoi(argv[++i]);
+        } else if (arg.compare(0, 2, "--") == 0) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            options.paths.push_back(arg);
+        }
+    }
+
+    if (options.paths.empty() || options.resolution <= 0.0 || options.scale <= 0.0
+     || options.repeat <= 0) {
+        usage(argv[0]);
+        return 1;
+    } else if (options.modes.empty()) {
+        options.modes.assign(kModes, kModes + kNumModes);
+    }
+
+    for (size_t i = 0; i < options.paths.size(); ++i) {
+        benchmark(options.paths[i], options);
+    }
+    return 0;
+}
@@ -0,0 +1,280 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <navi_astar/distance_transform.h>
+
+namespace navi_astar {
+
+/*
+ * Exact Euclidean Distance Transform
+ */
+void DistanceTransform::compute(uint8_t const *binary, unsigned int width, unsigned int height,
+                                double resolution, double max_distance, float *distances)
+{
+    // Larger than any distance that can occur in the grid or be returned
+    // after clamping, but small enough that its square is still finite.
+    float const infinity = std::max(static_cast<float>(width + height),
+                                    static_cast<float>(ceil(max_distance / resolution) + 1.0));
+
+    // Column pass: distance to the nearest obstacle in the same column. Both
+    // scans sweep entire rows at a time to stay cache-friendly.
+    for (unsigned int x = 0; x < width; ++x) {
+        distances[x] = (binary[x]) ? 0.0f : infinity;
+    }
+
+    for (unsigned int y = 1; y < height; ++y) {
+        uint8_t const *binary_row = binary + y * width;
+        float const *prev = distances + (y - 1) * width;
+        float *curr = distances + y * width;
+
+        for (unsigned int x = 0; x < width; ++x) {
+            curr[x] = (binary_row[x]) ? 0.0f : prev[x] + 1.0f;
+        }
+    }
+
+    for (unsigned int y = height - 1; y-- > 0;) {
+        float const *next = distances + (y + 1) * width;
+        float *curr = distances + y * width;
+
+        for (unsigned int x = 0; x < width; ++x) {
+            curr[x] = std::min(curr[x], next[x] + 1.0f);
+        }
+    }
+
+    // Row pass: combine the column distances into exact Euclidean distances.
+    row_.resize(width);
+    bounds_.resize(width + 1);
+    vertices_.resize(width);
+
+    float const clamp = static_cast<float>(max_distance);
+
+    for (unsigned int y = 0; y < height; ++y) {
+        float *row = distances + y * width;
+        lowerEnvelope(row, width);
+
+        for (unsigned int x = 0; x < width; ++x) {
+            row[x] = std::min(static_cast<float>(resolution * sqrt(row[x])), clamp);
+        }
+    }
+}
+
+void DistanceTransform::lowerEnvelope(float *row, unsigned int n)
+{
+    float const infinity = std::numeric_limits<float>::infinity();
+    float *f = &row_[0];
+    float *z = &bounds_[0];
+    int   *v = &vertices_[0];
+
+    for (unsigned int q = 0; q < n; ++q) {
+        f[q] = row[q] * row[q];
+    }
+
+    // Find the parabolas that make up the lower envelope of the samples.
+    int k = 0;
+    v[0] = 0;
+    z[0] = -infinity;
+    z[1] = +infinity;
+
+    for (int q = 1; q < (int)n; ++q) {
+        int p = v[k];
+        float s = ((f[q] + q * q) - (f[p] + p * p)) / (2 * (q - p));
+
+        // The new parabola hides the previous one; z[0] is -inf, so this
+        // always terminates at the first parabola.
+        while (s <= z[k]) {
+            --k;
+            p = v[k];
+            s = ((f[q] + q * q) - (f[p] + p * p)) / (2 * (q - p));
+        }
+
+        ++k;
+        v[k]     = q;
+        z[k]     = s;
+        z[k + 1] = +infinity;
+    }
+
+    // Evaluate the lower envelope at each sample.
+    k = 0;
+    for (int q = 0; q < (int)n; ++q) {
+        while (z[k + 1] < q) {
+            ++k;
+        }
+        int const p = v[k];
+        row[q] = (q - p) * (q - p) + f[p];
+    }
+}
+
+/*
+ * Tiled Distance Field
+ */
+DistanceField::DistanceField(void)
+    : threads_(0)
+    , tile_size_(128)
+    , width_(0)
+    , height_(0)
+    , tiles_x_(0)
+    , tiles_y_(0)
+    , margin_(0)
+    , resolution_(0.0)
+    , max_distance_(0.0)
+    , next_(0)
+{
+    setThreads(0);
+}
+
+void DistanceField::setThreads(unsigned int threads)
+{
+    if (threads == 0) {
+        threads = std::max(boost::thread::hardware_concurrency(), 1u);
+    }
+    threads_ = threads;
+    workers_.resize(threads_);
+
+    // The threads stay alive between updates, so they are only restarted
+    // when the number of threads actually changes.
+    if (!pool_ || pool_->GetThreads() != (int)threads_) {
+        pool_.reset(new navi_workers::WorkerPool(threads_));
+    }
+}
+
+void DistanceField::setTileSize(unsigned int tile_size)
+{
+    tile_size_ = std::max(tile_size, 1u);
+    width_  = 0;
+    height_ = 0;
+}
+
+size_t DistanceField::update(uint8_t const *binary, unsigned int width, unsigned int height,
+                             double resolution, double max_distance)
+{
+    unsigned int const size = width * height;
+
+    bool const reset = width != width_ || height != height_
+                    || resolution != resolution_ || max_distance != max_distance_;
+
+    if (reset) {
+        width_        = width;
+        height_       = height;
+        resolution_   = resolution;
+        max_distance_ = max_distance;
+        tiles_x_ = (width  + tile_size_ - 1) / tile_size_;
+        tiles_y_ = (height + tile_size_ - 1) / tile_size_;
+        margin_  = static_cast<unsigned int>(ceil(max_distance / resolution));
+
+        binary_.assign(binary, binary + size);
+        distances_.resize(size);
+        changed_.assign(tiles_x_ * tiles_y_, 1);
+    } else {
+        markChangedTiles(binary);
+    }
+
+    // Changes within the margin of a tile also affect that tile. Spreading
+    // whole tiles is conservative, but much cheaper than tracking cells.
+    int const spread = (margin_ + tile_size_ - 1) / tile_size_;
+    dirty_.clear();
+
+    for (int ty = 0; ty < (int)tiles_y_; ++ty)
+    for (int tx = 0; tx < (int)tiles_x_; ++tx) {
+        bool dirty = false;
+
+        for (int dy = -spread; dy <= spread && !dirty; ++dy)
+        for (int dx = -spread; dx <= spread && !dirty; ++dx) {
+            int const nx = tx + dx;
+            int const ny = ty + dy;
+
+            if (0 <= nx && nx < (int)tiles_x_ && 0 <= ny && ny < (int)tiles_y_) {
+                dirty = changed_[ny * tiles_x_ + nx];
+            }
+        }
+
+        if (dirty) {
+            dirty_.push_back(ty * tiles_x_ + tx);
+        }
+    }
+
+    // Rebuild the dirty tiles in parallel. The calling thread also acts as a
+    // worker, so a single dirty tile does not wake up the pool.
+    next_ = 0;
+
+    if (dirty_.size() > 1) {
+        pool_->Run(boost::bind(&DistanceField::work, this, _1));
+    } else if (dirty_.size() == 1) {
+        work(0);
+    }
+    return dirty_.size();
+}
+
+void DistanceField::markChangedTiles(uint8_t const *binary)
+{
+    std::fill(changed_.begin(), changed_.end(), 0);
+
+    for (unsigned int y = 0; y < height_; ++y) {
+        unsigned int const ty = y / tile_size_;
+
+        for (unsigned int tx = 0; tx < tiles_x_; ++tx) {
+            unsigned int const x0 = tx * tile_size_;
+            unsigned int const n  = std::min(tile_size_, width_ - x0);
+            unsigned int const offset = y * width_ + x0;
+
+            if (memcmp(binary + offset, &binary_[offset], n) != 0) {
+                memcpy(&binary_[offset], binary + offset, n);
+                changed_[ty * tiles_x_ + tx] = 1;
+            }
+        }
+    }
+}
+
+void DistanceField::work(int index)
+{
+    Worker &worker = workers_[index];
+
+    for (;;) {
+        unsigned int tile;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (next_ >= dirty_.size()) return;
+            tile = dirty_[next_++];
+        }
+        rebuildTile(tile, worker);
+    }
+}
+
+void DistanceField::rebuildTile(unsigned int tile, Worker &worker)
+{
+    unsigned int const tx = tile % tiles_x_;
+    unsigned int const ty = tile / tiles_x_;
+
+    // Tile bounds.
+    unsigned int const x0 = tx * tile_size_;
+    unsigned int const y0 = ty * tile_size_;
+    unsigned int const x1 = std::min(x0 + tile_size_, width_);
+    unsigned int const y1 = std::min(y0 + tile_size_, height_);
+
+    // Window bounds, including the margin.
+    unsigned int const wx0 = (x0 > margin_) ? x0 - margin_ : 0;
+    unsigned int const wy0 = (y0 > margin_) ? y0 - margin_ : 0;
+    unsigned int const wx1 = std::min(x1 + margin_, width_);
+    unsigned int const wy1 = std::min(y1 + margin_, height_);
+    unsigned int const ww  = wx1 - wx0;
+    unsigned int const wh  = wy1 - wy0;
+
+    worker.binary.resize(ww * wh);
+    worker.distances.resize(ww * wh);
+
+    for (unsigned int y = wy0; y < wy1; ++y) {
+        memcpy(&worker.binary[(y - wy0) * ww], &binary_[y * width_ + wx0], ww);
+    }
+
+    worker.transform.compute(&worker.binary[0], ww, wh, resolution_, max_distance_,
+                             &worker.distances[0]);
+
+    for (unsigned int y = y0; y < y1; ++y) {
+        float const *src = &worker.distances[(y - wy0) * ww + (x0 - wx0)];
+        std::copy(src, src + (x1 - x0), &distances_[y * width_ + x0]);
+    }
+}
+
+};
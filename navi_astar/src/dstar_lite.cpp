@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <navi_astar/dstar_lite.h>
+#include <navi_astar/grid.h>
+
+namespace navi_astar {
+
+static float const kInfinity = std::numeric_limits<float>::infinity();
+static float const kTolerance = 1e-3f;
+
+unsigned int const DStarLite::kNone = std::numeric_limits<unsigned int>::max();
+
+DStarLite::DStarLite(void)
+    : width_(0)
+    , height_(0)
+    , resolution_(0.0)
+    , start_(kNone)
+    , goal_(kNone)
+    , last_(kNone)
+    , km_(0.0f)
+    , expansions_(0)
+{
+}
+
+void DStarLite::initialize(unsigned int width, unsigned int height, double resolution,
+                           std::vector<float> const &cell_costs,
+                           unsigned int start, unsigned int goal)
+{
+    unsigned int const size = width * height;
+
+    width_      = width;
+    height_     = height;
+    resolution_ = resolution;
+    start_      = start;
+    last_       = start;
+    goal_       = goal;
+    km_         = 0.0f;
+
+    costs_ = cell_costs;
+    g_.assign(size, kInfinity);
+    rhs_.assign(size, kInfinity);
+    open_.resize(size);
+
+    Key const key = { getHeuristic(start_, goal_), 0.0f };
+    rhs_[goal_] = 0.0f;
+    open_.push(goal_, key);
+}
+
+void DStarLite::setStart(unsigned int start)
+{
+    // Offsetting every key by the distance the robot moved keeps the keys in
+    // the queue valid lower bounds without reordering them.
+    km_   += getHeuristic(last_, start);
+    last_  = start;
+    start_ = start;
+}
+
+size_t DStarLite::updateCosts(std::vector<float> const &cell_costs)
+{
+    changed_.clear();
+
+    for (unsigned int i = 0; i < costs_.size(); ++i) {
+        if (cell_costs[i] != costs_[i]) {
+            costs_[i] = cell_costs[i];
+            changed_.push_back(i);
+        }
+    }
+
+    // Edge costs are symmetric, so a changed cell affects its own edges and
+    // the edges of all of its neighbors. This also covers the diagonal edges
+    // between two neighbors that cut the corner of the changed cell.
+    for (size_t i = 0; i < changed_.size(); ++i) {
+        updateVertex(changed_[i]);
+        updateNeighbors(changed_[i]);
+    }
+    return changed_.size();
+}
+
+bool DStarLite::computeShortestPath(void)
+{
+    expansions_ = 0;
+
+    while (!open_.empty()) {
+        Key const key_old   = open_.topKey();
+        Key const key_start = calculateKey(start_);
+
+        // Keep expanding vertices whose keys tie with the start. Rounding in
+        // the keys could otherwise leave an inconsistent vertex on the path.
+        bool const consistent = rhs_[start_] == g_[start_];
+        if (consistent && key_old.primary > key_start.primary + kTolerance) break;
+
+        unsigned int const index = open_.top();
+        Key const key_new = calculateKey(index);
+        ++expansions_;
+
+        if (key_old < key_new) {
+            open_.push(index, key_new);
+        } else if (g_[index] > rhs_[index]) {
+            g_[index] = rhs_[index];
+            open_.remove(index);
+            updateNeighbors(index);
+        } else {
+            g_[index] = kInfinity;
+            updateVertex(index);
+            updateNeighbors(index);
+        }
+    }
+    return rhs_[start_] < kInfinity;
+}
+
+bool DStarLite::getPath(std::vector<unsigned int> &path) const
+{
+    path.clear();
+
+    if (start_ == kNone || !(g_[start_] < kInfinity)) {
+        return false;
+    }
+
+    unsigned int index = start_;
+    path.push_back(index);
+
+    while (index != goal_) {
+        int const x = index % width_;
+        int const y = index / width_;
+        unsigned int best = kNone;
+        float cost_best = kInfinity;
+
+        for (int i = 0; i < kMoves; ++i) {
+            int const nx = x + kMoveX[i];
+            int const ny = y + kMoveY[i];
+            if (nx < 0 || nx >= (int)width_ || ny < 0 || ny >= (int)height_) continue;
+            if (isCornerBlocked(&costs_[0], width_, x, y, i)) continue;
+
+            unsigned int const neighbor = ny * width_ + nx;
+            float const cost = getEdgeCost(index, neighbor, kMoveLength[i]) + g_[neighbor];
+
+            if (cost < cost_best) {
+                best      = neighbor;
+                cost_best = cost;
+            }
+        }
+
+        // Guard against cycles if the search tree is not fully consistent.
+        if (best == kNone || path.size() > g_.size()) {
+            path.clear();
+            return false;
+        }
+        index = best;
+        path.push_back(index);
+    }
+    return true;
+}
+
+DStarLite::Key DStarLite::calculateKey(unsigned int index) const
+{
+    float const cost = std::min(g_[index], rhs_[index]);
+    Key const key = { cost + getHeuristic(start_, index) + km_, cost };
+    return key;
+}
+
+float DStarLite::getHeuristic(unsigned int from, unsigned int to) const
+{
+    int const dx = (int)(from % width_) - (int)(to % width_);
+    int const dy = (int)(from / width_) - (int)(to / width_);
+    return resolution_ * getOctileDistance(std::abs(dx), std::abs(dy));
+}
+
+float DStarLite::getEdgeCost(unsigned int from, unsigned int to, float length) const
+{
+    return 0.5f * (costs_[from] + costs_[to]) * length * resolution_;
+}
+
+void DStarLite::updateVertex(unsigned int index)
+{
+    if (index != goal_) {
+        int const x = index % width_;
+        int const y = index / width_;
+        float rhs = kInfinity;
+
+        for (int i = 0; i < kMoves; ++i) {
+            int const nx = x + kMoveX[i];
+            int const ny = y + kMoveY[i];
+            if (nx < 0 || nx >= (int)width_ || ny < 0 || ny >= (int)height_) continue;
+            if (isCornerBlocked(&costs_[0], width_, x, y, i)) continue;
+
+            unsigned int const neighbor = ny * width_ + nx;
+            rhs = std::min(rhs, getEdgeCost(index, neighbor, kMoveLength[i]) + g_[neighbor]);
+        }
+        rhs_[index] = rhs;
+    }
+
+    if (g_[index] != rhs_[index]) {
+        open_.push(index, calculateKey(index));
+    } else {
+        open_.remove(index);
+    }
+}
+
+void DStarLite::updateNeighbors(unsigned int index)
+{
+    int const x = index % width_;
+    int const y = index / width_;
+
+    for (int i = 0; i < kMoves; ++i) {
+        int const nx = x + kMoveX[i];
+        int const ny = y + kMoveY[i];
+        if (nx < 0 || nx >= (int)width_ || ny < 0 || ny >= (int)height_) continue;
+
+        updateVertex(ny * width_ + nx);
+    }
+}
+
+};
@@ -0,0 +1,552 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <navi_astar/grid.h>
+#include <navi_astar/hierarchical.h>
+
+namespace navi_astar {
+
+static float const kInfinity = std::numeric_limits<float>::infinity();
+
+// Entrances at least this wide get a transition at each end instead of a
+// single one in the middle.
+static unsigned int const kLongEntrance = 6;
+
+// Reasons for rebuilding a cluster.
+static uint8_t const kCellsChanged   = 1;
+static uint8_t const kBordersChanged = 2;
+
+unsigned int const HierarchicalPlanner::kNone = std::numeric_limits<unsigned int>::max();
+
+HierarchicalPlanner::HierarchicalPlanner(void)
+    : cluster_size_(64)
+    , width_(0)
+    , height_(0)
+    , clusters_x_(0)
+    , clusters_y_(0)
+    , resolution_(0.0)
+    , start_(kNone)
+    , goal_(kNone)
+{
+}
+
+void HierarchicalPlanner::setClusterSize(unsigned int cluster_size)
+{
+    cluster_size_ = std::max(cluster_size, 2u);
+    clusters_.clear();
+}
+
+size_t HierarchicalPlanner::update(unsigned int width, unsigned int height, double resolution,
+                                   std::vector<float> const &cell_costs)
+{
+    bool const reset = width != width_ || height != height_ || resolution != resolution_
+                    || clusters_.empty();
+
+    if (reset) {
+        width_      = width;
+        height_     = height;
+        resolution_ = resolution;
+        clusters_x_ = (width  + cluster_size_ - 1) / cluster_size_;
+        clusters_y_ = (height + cluster_size_ - 1) / cluster_size_;
+        costs_      = cell_costs;
+
+        clusters_.resize(clusters_x_ * clusters_y_);
+        dirty_.assign(clusters_.size(), kCellsChanged);
+        borders_x_.assign((clusters_x_ - 1) * clusters_y_, std::vector<Transition>());
+        borders_y_.assign(clusters_x_ * (clusters_y_ - 1), std::vector<Transition>());
+
+        for (unsigned int cy = 0; cy < clusters_y_; ++cy)
+        for (unsigned int cx = 0; cx < clusters_x_; ++cx) {
+            Cluster &cluster = clusters_[cy * clusters_x_ + cx];
+            cluster.x0 = cx * cluster_size_;
+            cluster.y0 = cy * cluster_size_;
+            cluster.x1 = std::min(cluster.x0 + cluster_size_, width_);
+            cluster.y1 = std::min(cluster.y0 + cluster_size_, height_);
+        }
+    } else {
+        // Find the clusters that contain at least one changed cell.
+        dirty_.assign(clusters_.size(), 0);
+
+        for (unsigned int c = 0; c < clusters_.size(); ++c) {
+            Cluster const &cluster = clusters_[c];
+
+            for (unsigned int y = cluster.y0; y < cluster.y1; ++y) {
+                unsigned int const begin = y * width_ + cluster.x0;
+                unsigned int const end   = y * width_ + cluster.x1;
+
+                if (!std::equal(costs_.begin() + begin, costs_.begin() + end,
+                                cell_costs.begin() + begin)) {
+                    std::copy(cell_costs.begin() + begin, cell_costs.begin() + end,
+                              costs_.begin() + begin);
+                    dirty_[c] = kCellsChanged;
+                }
+            }
+        }
+    }
+
+    // Entrances on the borders of a changed cluster may have moved. The
+    // neighboring cluster only needs to be rebuilt if they actually did.
+    for (unsigned int cy = 0; cy < clusters_y_; ++cy)
+    for (unsigned int cx = 0; cx < clusters_x_; ++cx) {
+        if (!(dirty_[cy * clusters_x_ + cx] & kCellsChanged)) continue;
+
+        if (cx > 0 && buildBorderX(cx - 1, cy)) {
+            dirty_[cy * clusters_x_ + cx - 1] |= kBordersChanged;
+        }
+        if (cx + 1 < clusters_x_ && buildBorderX(cx, cy)) {
+            dirty_[cy * clusters_x_ + cx + 1] |= kBordersChanged;
+        }
+        if (cy > 0 && buildBorderY(cx, cy - 1)) {
+            dirty_[(cy - 1) * clusters_x_ + cx] |= kBordersChanged;
+        }
+        if (cy + 1 < clusters_y_ && buildBorderY(cx, cy)) {
+            dirty_[(cy + 1) * clusters_x_ + cx] |= kBordersChanged;
+        }
+    }
+
+    size_t rebuilt = 0;
+    for (unsigned int cy = 0; cy < clusters_y_; ++cy)
+    for (unsigned int cx = 0; cx < clusters_x_; ++cx) {
+        if (dirty_[cy * clusters_x_ + cx]) {
+            buildCluster(cx, cy);
+            ++rebuilt;
+        }
+    }
+
+    if (rebuilt > 0) {
+        linkClusters();
+    }
+    return rebuilt;
+}
+
+bool HierarchicalPlanner::search(unsigned int start, unsigned int goal,
+                                 std::vector<unsigned int> &path)
+{
+    path.clear();
+
+    if (!(costs_[start] < kInfinity) || !(costs_[goal] < kInfinity)) {
+        return false;
+    }
+    start_ = start;
+    goal_  = goal;
+
+    unsigned int const cluster_start = getClusterIndex(start);
+    unsigned int const cluster_goal  = getClusterIndex(goal);
+    Cluster const &start_cluster = clusters_[cluster_start];
+    Cluster const &goal_cluster  = clusters_[cluster_goal];
+
+    float cost_direct = kInfinity;
+    if (cluster_start == cluster_goal) {
+        searchCluster(start_cluster, start, goal);
+        cost_direct = getLocalCost(start_cluster, goal);
+    }
+
+    // Temporarily connect the start and goal to the entrances of the clusters
+    // that contain them.
+    searchCluster(start_cluster, start, kNone);
+    start_costs_.resize(start_cluster.nodes.size());
+    for (size_t i = 0; i < start_cluster.nodes.size(); ++i) {
+        start_costs_[i] = getLocalCost(start_cluster, start_cluster.nodes[i]);
+    }
+
+    searchCluster(goal_cluster, goal, kNone);
+    goal_costs_.resize(goal_cluster.nodes.size());
+    for (size_t i = 0; i < goal_cluster.nodes.size(); ++i) {
+        goal_costs_[i] = getLocalCost(goal_cluster, goal_cluster.nodes[i]);
+    }
+
+    // A* on the abstract graph. The start and goal are given the two ids
+    // after the last entrance.
+    unsigned int const size     = node_cells_.size();
+    unsigned int const id_start = size;
+    unsigned int const id_goal  = size + 1;
+
+    abstract_cost_.assign(size + 2, kInfinity);
+    abstract_parent_.assign(size + 2, kNone);
+    if (abstract_open_.capacity() != size + 2) {
+        abstract_open_.resize(size + 2);
+    } else {
+        abstract_open_.clear();
+    }
+
+    abstract_cost_[id_start] = 0.0f;
+    abstract_open_.push(id_start, getHeuristic(start, goal));
+
+    while (!abstract_open_.empty()) {
+        unsigned int const id = abstract_open_.pop();
+        if (id == id_goal) break;
+
+        if (id == id_start) {
+            for (size_t i = 0; i < start_cluster.nodes.size(); ++i) {
+                relaxAbstract(id, offsets_[cluster_start] + i, start_costs_[i]);
+            }
+            relaxAbstract(id, id_goal, cost_direct);
+            continue;
+        }
+
+        unsigned int const c = node_clusters_[id];
+        unsigned int const i = id - offsets_[c];
+        Cluster const &cluster = clusters_[c];
+        size_t const n = cluster.nodes.size();
+
+        for (size_t j = 0; j < n; ++j) {
+            if (j != i) {
+                relaxAbstract(id, offsets_[c] + j, cluster.costs[i * n + j]);
+            }
+        }
+
+        unsigned int const partner = node_partners_[id];
+        relaxAbstract(id, partner, getEdgeCost(node_cells_[id], node_cells_[partner], 1.0f));
+
+        if (c == cluster_goal) {
+            relaxAbstract(id, id_goal, goal_costs_[i]);
+        }
+    }
+
+    if (!(abstract_cost_[id_goal] < kInfinity)) {
+        return false;
+    }
+
+    abstract_path_.clear();
+    for (unsigned int id = id_goal; id != kNone; id = abstract_parent_[id]) {
+        abstract_path_.push_back(id);
+    }
+    std::reverse(abstract_path_.begin(), abstract_path_.end());
+
+    // Refine each abstract edge on the grid. Edges between two clusters join
+    // adjacent cells, so only edges inside a cluster need to be searched.
+    path.push_back(start);
+
+    for (size_t k = 1; k < abstract_path_.size(); ++k) {
+        unsigned int const prev = abstract_path_[k - 1];
+        unsigned int const curr = abstract_path_[k];
+        unsigned int const cell_prev = getAbstractCell(prev);
+        unsigned int const cell_curr = getAbstractCell(curr);
+        bool found = true;
+
+        if (prev == id_start) {
+            found = appendLocalPath(start_cluster, cell_prev, cell_curr, path);
+        } else if (curr == id_goal) {
+            found = appendLocalPath(goal_cluster, cell_prev, cell_curr, path);
+        } else if (node_clusters_[prev] == node_clusters_[curr]) {
+            found = appendLocalPath(clusters_[node_clusters_[prev]], cell_prev, cell_curr, path);
+        } else {
+            path.push_back(cell_curr);
+        }
+
+        if (!found) {
+            path.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+float HierarchicalPlanner::getHeuristic(unsigned int from, unsigned int to) const
+{
+    int const dx = (int)(from % width_) - (int)(to % width_);
+    int const dy = (int)(from / width_) - (int)(to / width_);
+    return resolution_ * getOctileDistance(std::abs(dx), std::abs(dy));
+}
+
+unsigned int HierarchicalPlanner::getAbstractCell(unsigned int id) const
+{
+    if (id < node_cells_.size()) {
+        return node_cells_[id];
+    } else if (id == node_cells_.size()) {
+        return start_;
+    } else {
+        return goal_;
+    }
+}
+
+void HierarchicalPlanner::relaxAbstract(unsigned int from, unsigned int to, float cost)
+{
+    if (!(cost < kInfinity)) return;
+
+    float const cost_path = abstract_cost_[from] + cost;
+    if (cost_path < abstract_cost_[to]) {
+        abstract_cost_[to]   = cost_path;
+        abstract_parent_[to] = from;
+        abstract_open_.push(to, cost_path + getHeuristic(getAbstractCell(to), goal_));
+    }
+}
+
+/*
+ * Abstract Graph Construction
+ */
+bool HierarchicalPlanner::buildBorderX(unsigned int cx, unsigned int cy)
+{
+    unsigned int const x  = (cx + 1) * cluster_size_ - 1;
+    unsigned int const y0 = cy * cluster_size_;
+    unsigned int const y1 = std::min(y0 + cluster_size_, height_);
+
+    std::vector<Transition> &border = borders_x_[cy * (clusters_x_ - 1) + cx];
+    return addTransitions(border, y0 * width_ + x, width_, 1, y1 - y0);
+}
+
+bool HierarchicalPlanner::buildBorderY(unsigned int cx, unsigned int cy)
+{
+    unsigned int const y  = (cy + 1) * cluster_size_ - 1;
+    unsigned int const x0 = cx * cluster_size_;
+    unsigned int const x1 = std::min(x0 + cluster_size_, width_);
+
+    std::vector<Transition> &border = borders_y_[cy * clusters_x_ + cx];
+    return addTransitions(border, y * width_ + x0, 1, width_, x1 - x0);
+}
+
+bool HierarchicalPlanner::addTransitions(std::vector<Transition> &border, unsigned int first_a,
+                                         unsigned int stride, unsigned int offset_b,
+                                         unsigned int length)
+{
+    transitions_.clear();
+    unsigned int run = 0;
+
+    for (unsigned int i = 0; i <= length; ++i) {
+        unsigned int const cell = first_a + i * stride;
+        bool const open = i < length
+                       && costs_[cell] < kInfinity
+                       && costs_[cell + offset_b] < kInfinity;
+
+        if (open) {
+            ++run;
+            continue;
+        } else if (run == 0) {
+            continue;
+        }
+
+        unsigned int const begin = i - run;
+        unsigned int const end   = i - 1;
+
+        if (run >= kLongEntrance) {
+            Transition const first = { first_a + begin * stride, first_a + begin * stride + offset_b };
+            Transition const last  = { first_a + end   * stride, first_a + end   * stride + offset_b };
+            transitions_.push_back(first);
+            transitions_.push_back(last);
+        } else {
+            unsigned int const middle = (begin + end) / 2;
+            Transition const only = { first_a + middle * stride, first_a + middle * stride + offset_b };
+            transitions_.push_back(only);
+        }
+        run = 0;
+    }
+
+    bool changed = transitions_.size() != border.size();
+    for (size_t i = 0; !changed && i < border.size(); ++i) {
+        changed = transitions_[i].cell_a != border[i].cell_a;
+    }
+
+    if (changed) {
+        border.swap(transitions_);
+    }
+    return changed;
+}
+
+void HierarchicalPlanner::buildCluster(unsigned int cx, unsigned int cy)
+{
+    Cluster &cluster = clusters_[cy * clusters_x_ + cx];
+    cluster.nodes.clear();
+
+    cluster.first[kWest] = cluster.nodes.size();
+    if (cx > 0) {
+        std::vector<Transition> const &border = borders_x_[cy * (clusters_x_ - 1) + cx - 1];
+        for (size_t i = 0; i < border.size(); ++i) {
+            cluster.nodes.push_back(border[i].cell_b);
+        }
+    }
+
+    cluster.first[kEast] = cluster.nodes.size();
+    if (cx + 1 < clusters_x_) {
+        std::vector<Transition> const &border = borders_x_[cy * (clusters_x_ - 1) + cx];
+        for (size_t i = 0; i < border.size(); ++i) {
+            cluster.nodes.push_back(border[i].cell_a);
+        }
+    }
+
+    cluster.first[kSouth] = cluster.nodes.size();
+    if (cy > 0) {
+        std::vector<Transition> const &border = borders_y_[(cy - 1) * clusters_x_ + cx];
+        for (size_t i = 0; i < border.size(); ++i) {
+            cluster.nodes.push_back(border[i].cell_b);
+        }
+    }
+
+    cluster.first[kNorth] = cluster.nodes.size();
+    if (cy + 1 < clusters_y_) {
+        std::vector<Transition> const &border = borders_y_[cy * clusters_x_ + cx];
+        for (size_t i = 0; i < border.size(); ++i) {
+            cluster.nodes.push_back(border[i].cell_a);
+        }
+    }
+
+    // Edge costs are symmetric, so one search per entrance fills both halves
+    // of the cost matrix.
+    size_t const n = cluster.nodes.size();
+    cluster.costs.assign(n * n, kInfinity);
+
+    for (size_t i = 0; i < n; ++i) {
+        searchCluster(cluster, cluster.nodes[i], kNone);
+
+        for (size_t j = i; j < n; ++j) {
+            float const cost = getLocalCost(cluster, cluster.nodes[j]);
+            cluster.costs[i * n + j] = cost;
+            cluster.costs[j * n + i] = cost;
+        }
+    }
+}
+
+void HierarchicalPlanner::linkClusters(void)
+{
+    unsigned int size = 0;
+    offsets_.resize(clusters_.size());
+
+    for (size_t c = 0; c < clusters_.size(); ++c) {
+        offsets_[c] = size;
+        size += clusters_[c].nodes.size();
+    }
+
+    node_cells_.resize(size);
+    node_clusters_.resize(size);
+    node_partners_.assign(size, kNone);
+
+    for (size_t c = 0; c < clusters_.size(); ++c) {
+        Cluster const &cluster = clusters_[c];
+
+        for (size_t i = 0; i < cluster.nodes.size(); ++i) {
+            node_cells_[offsets_[c] + i]    = cluster.nodes[i];
+            node_clusters_[offsets_[c] + i] = c;
+        }
+    }
+
+    // Both sides of a border list their transitions in the same order.
+    for (unsigned int cy = 0; cy < clusters_y_; ++cy)
+    for (unsigned int cx = 0; cx + 1 < clusters_x_; ++cx) {
+        unsigned int const west = cy * clusters_x_ + cx;
+        unsigned int const east = west + 1;
+        size_t const n = borders_x_[cy * (clusters_x_ - 1) + cx].size();
+
+        for (size_t i = 0; i < n; ++i) {
+            unsigned int const a = offsets_[west] + clusters_[west].first[kEast] + i;
+            unsigned int const b = offsets_[east] + clusters_[east].first[kWest] + i;
+            node_partners_[a] = b;
+            node_partners_[b] = a;
+        }
+    }
+
+    for (unsigned int cy = 0; cy + 1 < clusters_y_; ++cy)
+    for (unsigned int cx = 0; cx < clusters_x_; ++cx) {
+        unsigned int const south = cy * clusters_x_ + cx;
+        unsigned int const north = south + clusters_x_;
+        size_t const n = borders_y_[cy * clusters_x_ + cx].size();
+
+        for (size_t i = 0; i < n; ++i) {
+            unsigned int const a = offsets_[south] + clusters_[south].first[kNorth] + i;
+            unsigned int const b = offsets_[north] + clusters_[north].first[kSouth] + i;
+            node_partners_[a] = b;
+            node_partners_[b] = a;
+        }
+    }
+}
+
+/*
+ * Search Within a Cluster
+ */
+void HierarchicalPlanner::searchCluster(Cluster const &cluster, unsigned int source,
+                                        unsigned int target)
+{
+    unsigned int const cw   = cluster.x1 - cluster.x0;
+    unsigned int const ch   = cluster.y1 - cluster.y0;
+    unsigned int const size = cw * ch;
+
+    local_cost_.assign(size, kInfinity);
+    local_parent_.resize(size);
+    if (local_open_.capacity() < size) {
+        local_open_.resize(size);
+    } else {
+        local_open_.clear();
+    }
+
+    unsigned int const local_source = (source / width_ - cluster.y0) * cw + (source % width_ - cluster.x0);
+    unsigned int const local_target = (target == kNone) ? kNone
+                                    : (target / width_ - cluster.y0) * cw + (target % width_ - cluster.x0);
+
+    // Without a target, stop as soon as every entrance of the cluster has
+    // been settled instead of flooding the whole cluster.
+    unsigned int remaining = 0;
+    if (target == kNone) {
+        local_entrance_.assign(size, 0);
+
+        for (size_t i = 0; i < cluster.nodes.size(); ++i) {
+            unsigned int const node = cluster.nodes[i];
+            unsigned int const local = (node / width_ - cluster.y0) * cw + (node % width_ - cluster.x0);
+
+            if (!local_entrance_[local]) {
+                local_entrance_[local] = 1;
+                ++remaining;
+            }
+        }
+    }
+
+    local_cost_[local_source]   = 0.0f;
+    local_parent_[local_source] = kNone;
+    local_open_.push(local_source, 0.0f);
+
+    while (!local_open_.empty()) {
+        unsigned int const local = local_open_.pop();
+        if (local == local_target) break;
+        if (target == kNone && local_entrance_[local] && --remaining == 0) break;
+
+        int const x = local % cw;
+        int const y = local / cw;
+        unsigned int const cell = (cluster.y0 + y) * width_ + cluster.x0 + x;
+
+        for (int i = 0; i < kMoves; ++i) {
+            int const nx = x + kMoveX[i];
+            int const ny = y + kMoveY[i];
+            if (nx < 0 || nx >= (int)cw || ny < 0 || ny >= (int)ch) continue;
+            if (isCornerBlocked(&costs_[0], width_, cluster.x0 + x, cluster.y0 + y, i)) continue;
+
+            unsigned int const neighbor_local = ny * cw + nx;
+            unsigned int const neighbor_cell  = (cluster.y0 + ny) * width_ + cluster.x0 + nx;
+            float const cost = local_cost_[local] + getEdgeCost(cell, neighbor_cell, kMoveLength[i]);
+
+            if (cost < local_cost_[neighbor_local]) {
+                local_cost_[neighbor_local]   = cost;
+                local_parent_[neighbor_local] = local;
+                local_open_.push(neighbor_local, cost);
+            }
+        }
+    }
+}
+
+float HierarchicalPlanner::getLocalCost(Cluster const &cluster, unsigned int cell) const
+{
+    unsigned int const cw = cluster.x1 - cluster.x0;
+    return local_cost_[(cell / width_ - cluster.y0) * cw + (cell % width_ - cluster.x0)];
+}
+
+bool HierarchicalPlanner::appendLocalPath(Cluster const &cluster, unsigned int from,
+                                          unsigned int to, std::vector<unsigned int> &path)
+{
+    unsigned int const cw = cluster.x1 - cluster.x0;
+
+    searchCluster(cluster, from, to);
+    if (!(getLocalCost(cluster, to) < kInfinity)) {
+        return false;
+    }
+
+    // Walk back from the target, but leave out the first cell because it is
+    // already the last cell of the path.
+    segment_.clear();
+    unsigned int local = (to / width_ - cluster.y0) * cw + (to % width_ - cluster.x0);
+
+    while (local_parent_[local] != kNone) {
+        segment_.push_back((cluster.y0 + local / cw) * width_ + cluster.x0 + local % cw);
+        local = local_parent_[local];
+    }
+    path.insert(path.end(), segment_.rbegin(), segment_.rend());
+    return true;
+}
+
+};
@@ -3,15 +3,22 @@
 #include <string>
 #include <vector>
 
+#include <boost/bind.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/thread/thread.hpp>
 #include <ros/ros.h>
 #include <ros/console.h>
 #include <cv_bridge/cv_bridge.h>
 #include <pcl_ros/point_cloud.h>
+#include <pluginlib/class_list_macros.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <sensor_msgs/image_encodings.h>
 #include <tf/transform_datatypes.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <sensor_msgs/CameraInfo.h>
 #include <sensor_msgs/Image.h>
 #include <stereo_plane/Plane.h>
@@ -22,6 +29,8 @@
 
 #include "LineDetectionNode.hpp"
 
+PLUGINLIB_DECLARE_CLASS(line_detection, line_nodelet, line_node::LineNodelet, nodelet::Nodelet)
+
 namespace line_node {
 
 cv::Point3d VectorROStoCv(geometry_msgs::Vector3 const &vec)
@@ -34,21 +43,70 @@ cv::Point3d PointROStoCv(geometry_msgs::Point const &pt)
 	return cv::Point3d(pt.x, pt.y, pt.z);
 }
 
-// nodelet conversion
-LineNodelet::LineNodelet(void)
-	: nh_priv("~")
-{}
-
-ros::NodeHandle &LineNodelet::getNodeHandle(void)
+/**
+ * Evaluate the matched pulse-width kernel described by offset at count
+ * consecutive positions. The kernel is piecewise constant, so its response is
+ * a weighted sum of three box sums taken from the running sum of the source
+ * pixels. Responses below the threshold are suppressed to zero.
+ *
+ * \param sums   running sum of the source pixels at the first kernel position
+ * \param stride distance between adjacent entries of sums along the kernel
+ * \param width  length of the kernel
+ * \param a      start of the line pulse inside the kernel
+ * \param b      end of the line pulse inside the kernel
+ * \param dst    output response for each of the count positions
+ */
+static void PulseResponse(int const *sums, int stride, int width, int a, int b,
+                          float threshold, float *dst, int count)
 {
-	return nh;
-}
 
-ros::NodeHandle &LineNodelet::getPrivateNodeHandle(void)
-{
-	return nh_priv;
+	// Each support sums to -0.5 and the pulse sums to +1. A support may be
+	// empty when the dead zone is a single pixel wide.
+	float const weight_left   = (a > 0)     ? -0.5f / a           : 0.0f;
+	float const weight_center = +1.0f / (b - a);
+	float const weight_right  = (width > b) ? -0.5f / (width - b) : 0.0f;
+
+	int const *sums_begin  = sums;
+	int const *sums_center = sums + a * stride;
+	int const *sums_right  = sums + b * stride;
+	int const *sums_end    = sums + width * stride;
+	int i = 0;
+
+#if defined(__SSE2__)
+	__m128 const v_left      = _mm_set1_ps(weight_left);
+	__m128 const v_center    = _mm_set1_ps(weight_center);
+	__m128 const v_right     = _mm_set1_ps(weight_right);
+	__m128 const v_threshold = _mm_set1_ps(threshold);
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i const s0 = _mm_loadu_si128((__m128i const *)(sums_begin  + i));
+		__m128i const s1 = _mm_loadu_si128((__m128i const *)(sums_center + i));
+		__m128i const s2 = _mm_loadu_si128((__m128i const *)(sums_right  + i));
+		__m128i const s3 = _mm_loadu_si128((__m128i const *)(sums_end    + i));
+
+		// Box sums are exact in 32-bit integers before the conversion.
+		__m128 const box_left   = _mm_cvtepi32_ps(_mm_sub_epi32(s1, s0));
+		__m128 const box_center = _mm_cvtepi32_ps(_mm_sub_epi32(s2, s1));
+		__m128 const box_right  = _mm_cvtepi32_ps(_mm_sub_epi32(s3, s2));
+
+		__m128 const value = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v_left, box_left),
+		                                           _mm_mul_ps(v_center, box_center)),
+		                                _mm_mul_ps(v_right, box_right));
+		__m128 const strong = _mm_cmpge_ps(value, v_threshold);
+		_mm_storeu_ps(dst + i, _mm_and_ps(value, strong));
+	}
+#endif
+
+	for (; i < count; ++i) {
+		int const box_left   = sums_center[i] - sums_begin[i];
+		int const box_center = sums_right[i]  - sums_center[i];
+		int const box_right  = sums_end[i]    - sums_right[i];
+
+		float const value = (weight_left * box_left + weight_center * box_center)
+		                  + weight_right * box_right;
+		dst[i] = (value >= threshold) ? value : 0.0f;
+	}
 }
-// nodelet conversion
 
 void LineNodelet::onInit(void)
 {
@@ -63,9 +121,15 @@ void LineNodelet::onInit(void)
 	nh_priv.param<int>("cutoff",    m_width_cutoff, 2);
 	nh_priv.param<int>("threshold", m_threshold,    30);
 	nh_priv.param<int>("blur_size", m_blur_size,    5);
+	nh_priv.param<int>("threads",   m_threads,      0);
 	nh_priv.param<double>("border",    m_width_dead, 0.1452);
 	nh_priv.param<double>("thickness", m_width_line, 0.0726);
 
+	if (m_threads <= 0) {
+		m_threads = std::max<int>(boost::thread::hardware_concurrency(), 1);
+	}
+	m_pool.reset(new navi_workers::WorkerPool(m_threads));
+
 	// Static ground plane.
 	nh_priv.param<bool>("cache", m_cache, false);
 	nh_priv.param<std::string>("frame_camera", m_fr_camera, "/camera_link");
@@ -75,6 +139,12 @@ void LineNodelet::onInit(void)
 	m_tf      = boost::make_shared<tf::TransformListener>(nh, ros::Duration(1.0));
 	m_pub_pts = nh.advertise<PointCloudXYZ>("line_points", 10);
 
+	// Optional quantized copy of the points in the ground frame.
+	nh_priv.param<double>("compact_resolution", m_compact_res, 0.0);
+	if (m_compact_res > 0.0) {
+		m_pub_compact = nh.advertise<sensor_msgs::PointCloud2>("line_points_compact", 10);
+	}
+
 	if (m_debug) {
 		ROS_WARN("debugging topics are enabled; performance may be degraded");
 		m_pub_ker_hor    = m_it->advertise("line_kernel_hor", 10);
@@ -148,38 +218,47 @@ void LineNodelet::SetResolution(int width, int height)
 	m_rows  = height;
 }
 
-void LineNodelet::NonMaxSupr(cv::Mat src_hor, cv::Mat src_ver, PointCloudXYZ &dst, cv::Mat &mask)
+void LineNodelet::NonMaxSupr(cv::Mat src_hor, cv::Mat src_ver, int first, cv::Range rows,
+                             PointCloudXYZ &dst, cv::Mat &mask)
 {
 	ROS_ASSERT(src_hor.rows == src_ver.rows && src_hor.cols == src_ver.cols);
-	ROS_ASSERT(src_hor.type() == CV_64FC1 && src_ver.type() == CV_64FC1);
+	ROS_ASSERT(src_hor.type() == CV_32FC1 && src_ver.type() == CV_32FC1);
+	ROS_ASSERT(first <= rows.start && rows.end <= first + src_hor.rows);
 	ROS_ASSERT(m_valid);
 
-	mask.create(src_hor.rows, src_hor.cols, CV_8UC1);
-	mask.setTo(0);
+	// Every maximum is compared against its four neighbors, so the border of
+	// the image is skipped. The caller includes the rows above and below the
+	// range in src_hor and src_ver unless they are outside of the image.
+	int const y_begin = std::max(rows.start, 1);
+	int const y_end   = std::min(rows.end, m_rows - 1);
 
-	for (int y = 1; y < src_hor.rows - 1; ++y)
+	for (int y = y_begin; y < y_end; ++y)
 	for (int x = 1; x < src_hor.cols - 1; ++x) {
 		pcl::PointXYZ pt;
+		int const i = y - first;
 
-		double val_hor   = src_hor.at<double>(y, x);
-		double val_left  = src_hor.at<double>(y, x - 1);
-		double val_right = src_hor.at<double>(y, x + 1);
+		float val_hor   = src_hor.at<float>(i, x);
+		float val_left  = src_hor.at<float>(i, x - 1);
+		float val_right = src_hor.at<float>(i, x + 1);
 
-		double val_ver = src_ver.at<double>(y + 0, x);
-		double val_top = src_ver.at<double>(y - 1, x);
-		double val_bot = src_ver.at<double>(y + 1, x);
+		float val_ver = src_ver.at<float>(i + 0, x);
+		float val_top = src_ver.at<float>(i - 1, x);
+		float val_bot = src_ver.at<float>(i + 1, x);
 
 		bool is_hor = val_hor > val_left && val_hor > val_right && val_hor > m_threshold;
 		bool is_ver = val_ver > val_top  && val_ver > val_bot   && val_ver > m_threshold;
 
 		// Found a line; project it into 3D using the ground plane.
 		if (is_hor || is_ver) {
-			cv::Point3d pt_3d = GetGroundPoint(m_plane, cv::Point2d(x, y));
+			cv::Point3d pt_3d = GetGroundPoint(x, y);
 			pt.x = pt_3d.x;
 			pt.y = pt_3d.y;
 			pt.z = pt_3d.z;
 			dst.push_back(pt);
-			mask.at<uint8_t>(y, x) = 255;
+
+			if (!mask.empty()) {
+				mask.at<uint8_t>(y, x) = 255;
+			}
 		}
 	}
 }
@@ -251,6 +330,8 @@ void LineNodelet::UpdateCache(void)
 	}
 
 	if (!m_valid) {
+		UpdateRays();
+
 		// TODO: Switch to the actual vertical kernel.
 		m_horizon_hor = GeneratePulseFilter(*plane, dhor, m_kernel_hor, m_offset_hor);
 		m_horizon_ver = GeneratePulseFilter(*plane, dhor, m_kernel_ver, m_offset_ver);
@@ -297,14 +378,11 @@ void LineNodelet::ImageCallback(Image::ConstPtr const &msg_img,
 
 	// Convert the ROS Image and CameraInfo messages into OpenCV datatypes for
 	// processing. This avoids copying the data when possible.
-	cv::Mat img_src, img_src8;
+	cv::Mat img_src;
 	try {
 		m_model.fromCameraInfo(msg_cam);
 		cv_bridge::CvImageConstPtr src_tmp = cv_bridge::toCvShare(msg_img, enc::MONO8);
-
-		// TODO: Directly process the 8-bit image to avoid this type conversion.
-		img_src8 = src_tmp->image;
-		img_src8.convertTo(img_src, CV_64FC1);
+		img_src = src_tmp->image;
 	} catch (cv_bridge::Exception &e) {
 		ROS_WARN_THROTTLE(10, "unable to parse image message");
 		return;
@@ -315,23 +393,52 @@ void LineNodelet::ImageCallback(Image::ConstPtr const &msg_img,
 	SetGroundPlane(plane);
 	SetResolution(msg_img->width, msg_img->height);
 	UpdateCache();
+	UpdateGroundTable(m_plane);
 
-	cv::Mat img_hor, img_ver;
-	PulseFilter(img_src, img_hor, m_kernel_hor, m_offset_hor, true);
-	PulseFilter(img_src, img_ver, m_kernel_ver, m_offset_ver, false);
+	// Split the rows below the horizon into one band per thread. Nothing is
+	// detected above the horizon, so those rows are skipped entirely.
+	int const horizon = std::min(m_horizon_hor, m_horizon_ver);
+	int const threads = std::max(1, std::min(m_threads, m_rows - horizon));
+	m_bands.resize(threads);
 
-	if (m_blur_size > 1) {
-		BlurFilter(img_hor, img_hor, m_blur_size, false);
-		BlurFilter(img_ver, img_ver, m_blur_size, true);
+	for (int i = 0; i < threads; ++i) {
+		m_bands[i].rows.start = horizon + (m_rows - horizon) * i / threads;
+		m_bands[i].rows.end   = horizon + (m_rows - horizon) * (i + 1) / threads;
 	}
 
-	PointCloudXYZ::Ptr maxima = boost::make_shared<PointCloudXYZ>();
+	// The mask of maxima is only used for visualization.
 	cv::Mat maxima_mask;
-	NonMaxSupr(img_hor, img_ver, *maxima, maxima_mask);
+	if (m_debug) {
+		maxima_mask = cv::Mat(m_rows, m_cols, CV_8UC1, cv::Scalar(0));
+	}
+
+	// The calling thread processes the first band itself.
+	m_pool->Run(boost::bind(&LineNodelet::DetectBand, this, _1, img_src, &maxima_mask));
+
+	// Concatenate the bands in order to preserve the row-major point order.
+	size_t num_maxima = 0;
+	for (int i = 0; i < threads; ++i) {
+		num_maxima += m_bands[i].maxima.points.size();
+	}
+
+	PointCloudXYZ::Ptr maxima = boost::make_shared<PointCloudXYZ>();
+	maxima->points.reserve(num_maxima);
+
+	for (int i = 0; i < threads; ++i) {
+		PointCloudXYZ const &band_maxima = m_bands[i].maxima;
+		maxima->points.insert(maxima->points.end(), band_maxima.points.begin(),
+		                                            band_maxima.points.end());
+	}
+	maxima->width  = maxima->points.size();
+	maxima->height = 1;
 	maxima->header.stamp    = msg_img->header.stamp;
 	maxima->header.frame_id = msg_img->header.frame_id;
 	m_pub_pts.publish(maxima);
 
+	if (m_compact_res > 0.0 && m_pub_compact.getNumSubscribers() > 0) {
+		PublishCompact(*maxima);
+	}
+
 	if (m_debug) {
 		// Visualize the matched pulse width kernels.
 		cv::Mat img_ker_hor;
@@ -354,7 +461,19 @@ void LineNodelet::ImageCallback(Image::ConstPtr const &msg_img,
 		msg_ker_ver.image    = img_ker_ver;
 		m_pub_ker_ver.publish(msg_ker_ver.toImageMsg());
 
-		// Visualize the raw filter responses.
+		// Visualize the raw filter responses by stitching together the bands.
+		cv::Mat img_hor(m_rows, m_cols, CV_32FC1, cv::Scalar(0));
+		cv::Mat img_ver(m_rows, m_cols, CV_32FC1, cv::Scalar(0));
+
+		for (int i = 0; i < threads; ++i) {
+			Band const &band = m_bands[i];
+			if (band.rows.size() <= 0) continue;
+
+			cv::Range src_rows(band.rows.start - band.first, band.rows.end - band.first);
+			band.filter_hor.rowRange(src_rows).copyTo(img_hor.rowRange(band.rows));
+			band.filter_ver.rowRange(src_rows).copyTo(img_ver.rowRange(band.rows));
+		}
+
 		cv::Mat img_filter_hor;
 		img_hor.convertTo(img_filter_hor, CV_8UC1);
 
@@ -377,7 +496,7 @@ void LineNodelet::ImageCallback(Image::ConstPtr const &msg_img,
 
 		// Overlay the detected points over the original image.
 		cv::Mat img_maxima;
-		cv::cvtColor(img_src8, img_maxima, CV_GRAY2BGR);
+		cv::cvtColor(img_src, img_maxima, CV_GRAY2BGR);
 		img_maxima.setTo(cv::Scalar(0, 0, 255), maxima_mask);
 
 		cv_bridge::CvImage msg_maxima;
@@ -389,6 +508,66 @@ void LineNodelet::ImageCallback(Image::ConstPtr const &msg_img,
 	}
 }
 
+void LineNodelet::PublishCompact(PointCloudXYZ const &maxima)
+{
+	static int const num_fields = 2;
+	static char const *field_names[num_fields] = { "x", "y" };
+
+	tf::StampedTransform transform;
+	try {
+		m_tf->lookupTransform(m_fr_ground, maxima.header.frame_id, maxima.header.stamp, transform);
+	} catch (tf::TransformException const &e) {
+		ROS_WARN_THROTTLE(10, "%s", e.what());
+		return;
+	}
+
+	sensor_msgs::PointCloud2::Ptr msg = boost::make_shared<sensor_msgs::PointCloud2>();
+	msg->header.stamp    = maxima.header.stamp;
+	msg->header.frame_id = m_fr_ground;
+	msg->fields.resize(num_fields);
+
+	for (int i = 0; i < num_fields; ++i) {
+		msg->fields[i].name     = field_names[i];
+		msg->fields[i].offset   = i * sizeof(int16_t);
+		msg->fields[i].datatype = sensor_msgs::PointField::INT16;
+		msg->fields[i].count    = 1;
+	}
+	msg->is_bigendian = false;
+	msg->is_dense     = true;
+	msg->point_step   = num_fields * sizeof(int16_t);
+	msg->data.resize(maxima.points.size() * msg->point_step);
+
+	// Points are on the ground, so they are stored as integer multiples of
+	// the resolution in the ground plane. Horizontally adjacent maxima often
+	// fall into the same cell and are only stored once.
+	int16_t *data  = (msg->data.empty()) ? NULL : reinterpret_cast<int16_t *>(&msg->data[0]);
+	double   scale = 1.0 / m_compact_res;
+	size_t   num   = 0;
+
+	for (size_t i = 0; i < maxima.points.size(); ++i) {
+		pcl::PointXYZ const &pt = maxima.points[i];
+		tf::Vector3 pt_ground = transform * tf::Vector3(pt.x, pt.y, pt.z);
+		double x = floor(pt_ground.x() * scale + 0.5);
+		double y = floor(pt_ground.y() * scale + 0.5);
+
+		bool in_range = std::fabs(x) <= std::numeric_limits<int16_t>::max()
+		             && std::fabs(y) <= std::numeric_limits<int16_t>::max();
+		bool is_same  = num > 0 && data[2 * num - 2] == x && data[2 * num - 1] == y;
+
+		if (in_range && !is_same) {
+			data[2 * num + 0] = static_cast<int16_t>(x);
+			data[2 * num + 1] = static_cast<int16_t>(y);
+			++num;
+		}
+	}
+
+	msg->height   = 1;
+	msg->width    = num;
+	msg->row_step = num * msg->point_step;
+	msg->data.resize(msg->row_step);
+	m_pub_compact.publish(msg);
+}
+
 cv::Point3d LineNodelet::GetGroundPoint(Plane const &plane, cv::Point2d pt)
 {
 	cv::Point3d ray     = m_model.projectPixelTo3dRay(pt);
@@ -397,6 +576,42 @@ cv::Point3d LineNodelet::GetGroundPoint(Plane const &plane, cv::Point2d pt)
 	return (point.dot(normal) / ray.dot(normal)) * ray;
 }
 
+void LineNodelet::UpdateRays(void)
+{
+	ROS_ASSERT(m_rows > 0 && m_cols > 0);
+
+	// The x component of a pixel's ray only depends on its column and the y
+	// component only depends on its row.
+	m_ray_col.resize(m_cols);
+	m_ray_row.resize(m_rows);
+
+	for (int x = 0; x < m_cols; ++x) {
+		m_ray_col[x] = m_model.projectPixelTo3dRay(cv::Point2d(x, 0)).x;
+	}
+	for (int y = 0; y < m_rows; ++y) {
+		m_ray_row[y] = m_model.projectPixelTo3dRay(cv::Point2d(0, y)).y;
+	}
+}
+
+void LineNodelet::UpdateGroundTable(Plane const &plane)
+{
+	ROS_ASSERT((int)m_ray_col.size() == m_cols && (int)m_ray_row.size() == m_rows);
+
+	cv::Point3d normal = VectorROStoCv(plane.normal);
+	cv::Point3d point  = PointROStoCv(plane.point);
+
+	m_ground_col.resize(m_cols);
+	m_ground_row.resize(m_rows);
+	m_ground_dist = point.dot(normal);
+
+	for (int x = 0; x < m_cols; ++x) {
+		m_ground_col[x] = normal.x * m_ray_col[x];
+	}
+	for (int y = 0; y < m_rows; ++y) {
+		m_ground_row[y] = normal.y * m_ray_row[y] + normal.z;
+	}
+}
+
 double LineNodelet::ProjectDistance(Plane const &plane, cv::Point2d pt, cv::Point3d offset)
 {
 	// Project the expected edge points back into the image.
@@ -421,7 +636,7 @@ double LineNodelet::ReprojectDistance(Plane const &plane, cv::Point2d pt, cv::Po
 int LineNodelet::GeneratePulseFilter(Plane const &plane, cv::Point3d dw, cv::Mat &kernel,
                                      std::vector<Offset> &offsets)
 {
-	static Offset const offset_template = { 0, 0 };
+	static Offset const offset_template = { 0, 0, 0, 0 };
 
 	ROS_ASSERT(m_rows > 0 && m_cols > 0);
 	ROS_ASSERT(m_width_line > 0.0);
@@ -477,6 +692,8 @@ int LineNodelet::GeneratePulseFilter(Plane const &plane, cv::Point3d dw, cv::Mat
 
 			offsets[r].neg = offs_both_neg;
 			offsets[r].pos = offs_both_pos;
+			offsets[r].line_begin = a;
+			offsets[r].line_end   = b;
 			horizon        = r;
 
 		} else {
@@ -487,78 +704,128 @@ int LineNodelet::GeneratePulseFilter(Plane const &plane, cv::Point3d dw, cv::Mat
 	return 0;
 }
 
-void LineNodelet::PulseFilter(cv::Mat src, cv::Mat &dst, cv::Mat ker,
-                                    std::vector<Offset> const &offsets,
-                                    bool horizontal)
+void LineNodelet::PulseFilter(cv::Mat src, cv::Mat &dst, std::vector<Offset> const &offsets,
+                              bool horizontal, cv::Range rows, std::vector<int> &sums)
 {
-	ROS_ASSERT(src.type() == CV_64FC1);
-	ROS_ASSERT(ker.type() == CV_64FC1);
-	ROS_ASSERT(ker.rows == src.rows && ker.cols == ker.cols);
-	ROS_ASSERT((int)offsets.size() == ker.rows);
+	ROS_ASSERT(src.type() == CV_8UC1);
+	ROS_ASSERT((int)offsets.size() == src.rows);
+	ROS_ASSERT(0 <= rows.start && rows.start <= rows.end && rows.end <= src.rows);
 
-	dst.create(src.rows, src.cols, CV_64FC1);
-	dst.setTo(std::numeric_limits<double>::quiet_NaN());
+	dst.create(rows.size(), src.cols, CV_32FC1);
+	dst.setTo(std::numeric_limits<float>::quiet_NaN());
 
-	for (int r = m_rows - 1; r >= 0; --r) {
-		Offset const &offset = offsets[r];
+	if (horizontal) {
+		sums.resize(src.cols + 1);
+		int *prefix = &sums[0];
 
-		// Select the pre-computed kernel for this row.
-		cv::Range ker_rows(r, r + 1);
-		cv::Range ker_cols(0, offset.neg + offset.pos);
-		cv::Mat ker_chunk = ker(ker_rows, ker_cols);
+		for (int r = rows.end - 1; r >= rows.start; --r) {
+			Offset const &offset = offsets[r];
+			int const width = offset.neg + offset.pos;
 
-		for (int c = m_cols - 1; c >= 0; --c) {
 			// At or above the horizon line.
-			if (offset.pos == 0 && offset.neg == 0) break;
-
-			// Select the region of the source image to convolve with the
-			// kernel. This may not be centered on (c, r) due to the distance
-			// distortion caused by perspective projection.
-			cv::Mat src_chunk;
-
-			if (horizontal) {
-				cv::Range src_rows(r, r + 1);
-				cv::Range src_cols(c - offset.neg, c + offset.pos);
-
-				if (src_cols.start >= 0 && src_cols.end <= m_cols) {
-					src_chunk = src(src_rows, src_cols);
-				} else {
-					continue;
-				}
-			} else {
-				cv::Range src_rows(r - offset.neg, r + offset.pos);
-				cv::Range src_cols(c, c + 1);
-
-				if (src_rows.start >= 0 && src_rows.end <= m_rows) {
-					src_chunk = src(src_rows, src_cols).t();
-				} else {
-					continue;
-				}
+			if (width == 0) break;
+
+			// The kernel is only defined where it fits entirely in the image.
+			int const count = src.cols - offset.neg - std::max(offset.pos, 1) + 1;
+			if (count <= 0) continue;
+
+			uint8_t const *src_row = src.ptr<uint8_t>(r);
+			prefix[0] = 0;
+			for (int c = 0; c < src.cols; ++c) {
+				prefix[c + 1] = prefix[c] + src_row[c];
 			}
 
-			double value = src_chunk.dot(ker_chunk);
-			if (value >= m_threshold) {
-				dst.at<double>(r, c) = value;
-			} else {
-				dst.at<double>(r, c) = 0;
+			PulseResponse(prefix, 1, width, offset.line_begin, offset.line_end,
+			              m_threshold, dst.ptr<float>(r - rows.start) + offset.neg, count);
+		}
+	} else {
+		// Find the source rows covered by the kernels of the requested rows.
+		int first = src.rows;
+		int last  = 0;
+
+		for (int r = rows.start; r < rows.end; ++r) {
+			Offset const &offset = offsets[r];
+			if (offset.neg + offset.pos == 0) continue;
+
+			first = std::min(first, r - offset.neg);
+			last  = std::max(last,  r + offset.pos);
+		}
+		first = std::max(first, 0);
+		last  = std::min(last, src.rows);
+
+		if (first >= last) return;
+
+		// Running sum down each column. Row i holds the sum of the source rows
+		// from first up to first + i, so the kernel for every column of a row
+		// can be evaluated at once from four rows of sums.
+		int const stride = src.cols;
+		sums.resize((last - first + 1) * stride);
+		int *prefix = &sums[0];
+
+		std::fill(prefix, prefix + stride, 0);
+		for (int r = first; r < last; ++r) {
+			uint8_t const *src_row = src.ptr<uint8_t>(r);
+			int const *prefix_prev = prefix + (r - first) * stride;
+			int *prefix_next = prefix + (r - first + 1) * stride;
+
+			for (int c = 0; c < src.cols; ++c) {
+				prefix_next[c] = prefix_prev[c] + src_row[c];
 			}
 		}
+
+		for (int r = rows.end - 1; r >= rows.start; --r) {
+			Offset const &offset = offsets[r];
+			int const width = offset.neg + offset.pos;
+
+			// At or above the horizon line.
+			if (width == 0) break;
+
+			// The kernel is only defined where it fits entirely in the image.
+			if (r - offset.neg < 0 || r + offset.pos > src.rows) continue;
+
+			PulseResponse(prefix + (r - offset.neg - first) * stride, stride, width,
+			              offset.line_begin, offset.line_end,
+			              m_threshold, dst.ptr<float>(r - rows.start), src.cols);
+		}
 	}
 }
 
-void LineNodelet::BlurFilter(cv::Mat src, cv::Mat dst, int width, bool horizontal)
+void LineNodelet::DetectBand(int index, cv::Mat src, cv::Mat *mask)
 {
-	cv::Size size = (horizontal) ? cv::Size(width, 1) : cv::Size(1, width);
-	cv::boxFilter(src, dst, CV_64FC1, size);
+	if (index < static_cast<int>(m_bands.size())) {
+		DetectLines(src, &m_bands[index], mask);
+	}
 }
 
-};
+void LineNodelet::DetectLines(cv::Mat src, Band *band, cv::Mat *mask)
+{
+	band->maxima.clear();
+	if (band->rows.size() <= 0) return;
 
-int main(int argc, char **argv)
+	// Blurring and non-maximal supression both look past the edges of the
+	// band, so the filter responses are also computed for a halo of rows on
+	// either side. Those rows are overlapped with the neighboring bands.
+	int const halo = m_blur_size / 2 + 1;
+	cv::Range rows(std::max(band->rows.start - halo, 0),
+	               std::min(band->rows.end + halo, src.rows));
+	band->first = rows.start;
+
+	PulseFilter(src, band->filter_hor, m_offset_hor, true,  rows, band->sums_hor);
+	PulseFilter(src, band->filter_ver, m_offset_ver, false, rows, band->sums_ver);
+
+	if (m_blur_size > 1) {
+		BlurFilter(band->filter_hor, band->filter_hor, m_blur_size, false);
+		BlurFilter(band->filter_ver, band->filter_ver, m_blur_size, true);
+	}
+
+	NonMaxSupr(band->filter_hor, band->filter_ver, band->first, band->rows,
+	           band->maxima, *mask);
+}
+
+void LineNodelet::BlurFilter(cv::Mat src, cv::Mat dst, int width, bool horizontal)
 {
-	ros::init(argc, argv, "line_detection");
-	line_node::LineNodelet node;
-	node.onInit();
-	ros::spin();
-	return 0;
+	cv::Size size = (horizontal) ? cv::Size(width, 1) : cv::Size(1, width);
+	cv::boxFilter(src, dst, -1, size);
 }
+
+};
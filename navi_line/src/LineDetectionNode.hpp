@@ -6,6 +6,7 @@
 
 #include <ros/ros.h>
 #include <boost/smart_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <opencv/cv.h>
 #include <pcl_ros/point_cloud.h>
 #include <pcl/point_types.h>
@@ -13,6 +14,7 @@
 #include <message_filters/time_synchronizer.h>
 #include <image_geometry/pinhole_camera_model.h>
 #include <image_transport/image_transport.h>
+#include <nodelet/nodelet.h>
 #include <sensor_msgs/CameraInfo.h>
 #include <sensor_msgs/Image.h>
 #include <tf/transform_listener.h>
@@ -21,6 +23,8 @@
 #include <sensor_msgs/Image.h>
 #include <stereo_plane/Plane.h>
 
+#include <navi_workers/worker_pool.h>
+
 #include <message_filters/subscriber.h>
 #include <message_filters/sync_policies/approximate_time.h>
 #include <image_transport/subscriber_filter.h>
@@ -38,14 +42,9 @@ using stereo_plane::Plane;
 typedef pcl::PointCloud<pcl::PointXYZ> PointCloudXYZ;
 typedef mf::sync_policies::ApproximateTime<Image, CameraInfo, Plane> Policy;
 
-class LineNodelet {
+class LineNodelet : public nodelet::Nodelet {
 public:
-	// nodelet conversion
-	LineNodelet(void);
-	ros::NodeHandle &getNodeHandle(void);
-	ros::NodeHandle &getPrivateNodeHandle(void);
 	virtual void onInit(void);
-	// nodelet conversion
 
 	void SetCutoffWidth(int  width);
 	void SetDeadWidth(double width);
@@ -77,9 +76,13 @@ public:
 	 *
 	 * \param src_hor horizontal filter response from MatchedFilter()
 	 * \param src_ver vertical filter response from MatchedFilter()
-	 * \param pts list of local maxima in the filter response
+	 * \param first   image row that corresponds to the first row of src_hor
+	 * \param rows    image rows to search for local maxima
+	 * \param pts     list of local maxima in the filter response
+	 * \param mask    image-sized mask that is set at each local maximum; this
+	 *                is skipped if the mask is empty
 	 */
-	void NonMaxSupr(cv::Mat src_hor, cv::Mat src_ver,
+	void NonMaxSupr(cv::Mat src_hor, cv::Mat src_ver, int first, cv::Range rows,
 	                pcl::PointCloud<pcl::PointXYZ> &dst, cv::Mat &mask);
 
 	/**
@@ -92,20 +95,85 @@ public:
 	                   stereo_plane::Plane::ConstPtr const &msg_plane);
 
 protected:
+	// Extent of the pulse kernel around a pixel. The line pulse occupies
+	// [line_begin, line_end) of the neg + pos kernel entries.
 	struct Offset {
 		int neg, pos;
+		int line_begin, line_end;
 	};
 
-	ros::NodeHandle nh, nh_priv;
+	// Rows of the image that are processed by one thread, along with that
+	// thread's scratch space. The filter responses start at row first and
+	// include a halo of rows on either side of the band.
+	struct Band {
+		cv::Range rows;
+		int first;
+		cv::Mat filter_hor, filter_ver;
+		std::vector<int> sums_hor, sums_ver;
+		PointCloudXYZ maxima;
+	};
 
 	void TransformPlane(Plane const &src, Plane &dst, std::string frame_id);
 
 	cv::Point3d GetGroundPoint(Plane const &plane, cv::Point2d pt);
+
+	/**
+	 * Intersection of a pixel's ray with the ground plane passed to the last
+	 * call to UpdateGroundTable(). Equivalent to GetGroundPoint(), but only
+	 * reads from the tables.
+	 */
+	inline cv::Point3d GetGroundPoint(int x, int y) const
+	{
+		double scale = m_ground_dist / (m_ground_col[x] + m_ground_row[y]);
+		return cv::Point3d(scale * m_ray_col[x], scale * m_ray_row[y], scale);
+	}
+
+	/**
+	 * Tabulate the ray through each column and row of the image. Rays are
+	 * separable, so the ray through (x, y) is (m_ray_col[x], m_ray_row[y], 1).
+	 */
+	void UpdateRays(void);
+
+	/**
+	 * Tabulate the column and row terms of the dot product between each ray
+	 * and the normal of plane. This only touches one entry per row and per
+	 * column, so it is cheap enough to run on every frame.
+	 */
+	void UpdateGroundTable(Plane const &plane);
 	double ProjectDistance(Plane const &plane, cv::Point2d pt, cv::Point3d offset);
 	double ReprojectDistance(Plane const &plane, cv::Point2d pt, cv::Point2d offset);
 	int GeneratePulseFilter(Plane const &plane, cv::Point3d dw, cv::Mat &kernel, std::vector<Offset> &offsets);
-	void PulseFilter(cv::Mat src, cv::Mat &dst, cv::Mat kernel,
-	                 std::vector<Offset> const &offsets, bool horizontal);
+
+	/**
+	 * Convolve each row of the image with its matched pulse-width kernel. The
+	 * response is NaN wherever the kernel does not fit inside the image.
+	 *
+	 * \param src  grayscale input image with type CV_8UC1
+	 * \param dst  filter response of type CV_32FC1 with one row per row in rows
+	 * \param rows range of image rows to filter
+	 * \param sums scratch space for running sums of the source image
+	 */
+	void PulseFilter(cv::Mat src, cv::Mat &dst, std::vector<Offset> const &offsets,
+	                 bool horizontal, cv::Range rows, std::vector<int> &sums);
+
+	/**
+	 * Run the pulse filter, blur and non-maximal supression on one band of
+	 * rows. Bands only share the mask, and write to disjoint rows of it.
+	 */
+	void DetectLines(cv::Mat src, Band *band, cv::Mat *mask);
+
+	/**
+	 * Run DetectLines() on the index-th band, if there is one. This is the
+	 * job handed to the worker pool, which may have more threads than bands.
+	 */
+	void DetectBand(int index, cv::Mat src, cv::Mat *mask);
+
+	/**
+	 * Publish the line points projected into the ground frame and quantized
+	 * to 16-bit multiples of the compact_resolution parameter. This takes a
+	 * quarter of the space of a PointXYZ per point.
+	 */
+	void PublishCompact(PointCloudXYZ const &maxima);
 	bool GetTFPlane(ros::Time stamp, std::string fr_fixed, std::string fr_ground, Plane &plane);
 
 private:
@@ -115,6 +183,7 @@ private:
 	int m_rows;
 	int m_cols;
 	int m_blur_size;
+	int m_threads;
 	size_t m_num_prev;
 	double m_width_dead;
 	double m_width_line;
@@ -132,12 +201,22 @@ private:
 	int                 m_horizon_ver, m_horizon_hor;
 	cv::Mat             m_kernel_ver,  m_kernel_hor;
 	std::vector<Offset> m_offset_ver,  m_offset_hor;
+	std::vector<Band>   m_bands;
+	boost::scoped_ptr<navi_workers::WorkerPool> m_pool;
+
+	// Ground plane intersection lookup tables.
+	std::vector<double> m_ray_col,    m_ray_row;
+	std::vector<double> m_ground_col, m_ground_row;
+	double              m_ground_dist;
 
 	ros::NodeHandle m_nh;
 	image_geometry::PinholeCameraModel m_model;
 	boost::shared_ptr<tf::TransformListener> m_tf;
 
+	double m_compact_res;
+
 	ros::Publisher m_pub_pts;
+	ros::Publisher m_pub_compact;
 	it::ImageTransport         *m_it;
 	it::SubscriberFilter       *m_sub_img;
 	mf::Subscriber<CameraInfo> *m_sub_info;
@@ -1,15 +1,208 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <costmap_2d/cost_values.h>
+#include <pluginlib/class_list_macros.h>
+
 #include "line_mask.hpp"
 
-namespace navi_line {
+PLUGINLIB_DECLARE_CLASS(line_detection, mask_nodelet, navi_line::LineMaskNode, nodelet::Nodelet)
 
-LineMaskNode::LineMaskNode(void)
-	: nh_priv("~")
-{}
+namespace navi_line {
 
 void LineMaskNode::onInit(void)
 {
+	ros::NodeHandle nh      = getNodeHandle();
+	ros::NodeHandle nh_priv = getPrivateNodeHandle();
+
+	nh_priv.param<std::string>("frame_odom", m_fr_odom, "/odom");
+	nh_priv.param<std::string>("frame_base", m_fr_base, "/base_footprint");
+	nh_priv.param<double>("width",          m_width,          10.0);
+	nh_priv.param<double>("resolution",     m_resolution,     0.05);
+	nh_priv.param<double>("line_radius",    m_line_radius,    0.05);
+	nh_priv.param<double>("raytrace_range", m_raytrace_range, 4.0);
+	ROS_ASSERT(m_width > 0.0 && m_resolution > 0.0 && m_line_radius >= 0.0);
+
+	// The costmap starts out centered on the origin of the odometry frame.
+	// With fewer than two cells on a side, snapping the origin to the grid
+	// can leave the robot just outside of the map.
+	m_cells = (int)ceil(m_width / m_resolution);
+	if (m_cells < 2) {
+		NODELET_WARN("width %f is less than two cells; using two cells", m_width);
+		m_cells = 2;
+	}
+	m_costmap = costmap_2d::Costmap2D(m_cells, m_cells, m_resolution,
+	                                  -0.5 * m_cells * m_resolution,
+	                                  -0.5 * m_cells * m_resolution);
+
+	// Precompute the cells covered by a line centered on the origin.
+	int const radius = (int)floor(m_line_radius / m_resolution);
+	for (int dy = -radius; dy <= radius; ++dy)
+	for (int dx = -radius; dx <= radius; ++dx) {
+		if (dx * dx + dy * dy <= radius * radius) {
+			m_footprint.push_back(std::make_pair(dx, dy));
+		}
+	}
+
+	m_stamp.assign(m_cells * m_cells, 0);
+	m_endpoints.reserve(m_cells * m_cells);
+	m_generation = 0;
+
+	m_msg.header.frame_id = m_fr_odom;
+	m_msg.info.resolution = m_resolution;
+	m_msg.info.width      = m_cells;
+	m_msg.info.height     = m_cells;
+	m_msg.info.origin.orientation.w = 1.0;
+	m_msg.data.resize(m_cells * m_cells);
+
 	m_tf  = boost::make_shared<tf::TransformListener>(nh, ros::Duration(1.0));
-	m_map = boost::make_shared<Costmap2DROS>("obstacles", *m_tf);
+	m_pub = nh.advertise<nav_msgs::OccupancyGrid>("line_mask", 1);
+	m_sub = nh.subscribe("line_points", 1, &LineMaskNode::PointCallback, this);
+}
+
+void LineMaskNode::PointCallback(PointCloudXYZ::ConstPtr const &pc)
+{
+	tf::StampedTransform pc_to_odom, base_to_odom;
+
+	try {
+		m_tf->waitForTransform(m_fr_odom, pc->header.frame_id, pc->header.stamp, ros::Duration(1.0));
+		m_tf->lookupTransform(m_fr_odom, pc->header.frame_id, pc->header.stamp, pc_to_odom);
+		m_tf->lookupTransform(m_fr_odom, m_fr_base, pc->header.stamp, base_to_odom);
+	} catch (tf::TransformException const &e) {
+		NODELET_ERROR_THROTTLE(10, "%s", e.what());
+		return;
+	}
+
+	double const robot_x = base_to_odom.getOrigin().x();
+	double const robot_y = base_to_odom.getOrigin().y();
+	UpdateOrigin(robot_x, robot_y);
+
+	unsigned int robot_col, robot_row;
+	if (!m_costmap.worldToMap(robot_x, robot_y, robot_col, robot_row)) {
+		NODELET_ERROR_THROTTLE(10, "robot is outside of the line mask");
+		return;
+	}
+
+	// Stamps wrap around after 2^32 pointclouds.
+	if (++m_generation == 0) {
+		std::fill(m_stamp.begin(), m_stamp.end(), 0);
+		m_generation = 1;
+	}
+
+	// Find the cells that contain line points. Many points usually fall into
+	// the same cell, so each cell is only raytraced and marked once.
+	m_endpoints.clear();
+
+	for (size_t i = 0; i < pc->points.size(); ++i) {
+		pcl::PointXYZ const &pt = pc->points[i];
+		tf::Point const pt_odom = pc_to_odom * tf::Point(pt.x, pt.y, pt.z);
+
+		unsigned int col, row;
+		if (!m_costmap.worldToMap(pt_odom.x(), pt_odom.y(), col, row)) continue;
+
+		int const index = row * m_cells + col;
+		if (m_stamp[index] != m_generation) {
+			m_stamp[index] = m_generation;
+			m_endpoints.push_back(index);
+		}
+	}
+
+	// Clear the space between the robot and each line point before marking,
+	// so rays never erase lines that were seen in this pointcloud. Rays are
+	// cut short at the raytrace range.
+	double const range_cells = m_raytrace_range / m_resolution;
+
+	for (size_t i = 0; i < m_endpoints.size(); ++i) {
+		int const col = m_endpoints[i] % m_cells;
+		int const row = m_endpoints[i] / m_cells;
+		double const dx = col - (int)robot_col;
+		double const dy = row - (int)robot_row;
+		double const dist = sqrt(dx * dx + dy * dy);
+
+		if (dist <= range_cells) {
+			ClearRay(robot_col, robot_row, col, row);
+		} else if (range_cells > 0.0) {
+			double const scale = range_cells / dist;
+			ClearRay(robot_col, robot_row, robot_col + (int)(dx * scale),
+			                               robot_row + (int)(dy * scale));
+		}
+	}
+
+	for (size_t i = 0; i < m_endpoints.size(); ++i) {
+		MarkFootprint(m_endpoints[i] % m_cells, m_endpoints[i] / m_cells);
+	}
+
+	if (m_pub.getNumSubscribers() > 0) {
+		PublishMask(pc->header.stamp);
+	}
+}
+
+void LineMaskNode::UpdateOrigin(double robot_x, double robot_y)
+{
+	// Snap the origin to the grid so that cells keep their positions.
+	double const half  = 0.5 * m_cells * m_resolution;
+	double const new_x = floor((robot_x - half) / m_resolution) * m_resolution;
+	double const new_y = floor((robot_y - half) / m_resolution) * m_resolution;
+
+	if (new_x != m_costmap.getOriginX() || new_y != m_costmap.getOriginY()) {
+		m_costmap.updateOrigin(new_x, new_y);
+	}
+}
+
+void LineMaskNode::ClearRay(int x0, int y0, int x1, int y1)
+{
+	int const dx = std::abs(x1 - x0);
+	int const dy = std::abs(y1 - y0);
+	int const sx = (x0 < x1) ? 1 : -1;
+	int const sy = (y0 < y1) ? 1 : -1;
+	int error = dx - dy;
+	int x = x0;
+	int y = y0;
+
+	while (x != x1 || y != y1) {
+		m_costmap.setCost(x, y, costmap_2d::FREE_SPACE);
+
+		int const error2 = 2 * error;
+		if (error2 > -dy) {
+			error -= dy;
+			x += sx;
+		}
+		if (error2 < dx) {
+			error += dx;
+			y += sy;
+		}
+	}
+}
+
+void LineMaskNode::MarkFootprint(int x, int y)
+{
+	for (size_t i = 0; i < m_footprint.size(); ++i) {
+		int const cx = x + m_footprint[i].first;
+		int const cy = y + m_footprint[i].second;
+
+		if (0 <= cx && cx < m_cells && 0 <= cy && cy < m_cells) {
+			m_costmap.setCost(cx, cy, costmap_2d::LETHAL_OBSTACLE);
+		}
+	}
+}
+
+void LineMaskNode::PublishMask(ros::Time stamp)
+{
+	unsigned char const *costs = m_costmap.getCharMap();
+
+	m_msg.header.stamp           = stamp;
+	m_msg.info.map_load_time     = stamp;
+	m_msg.info.origin.position.x = m_costmap.getOriginX();
+	m_msg.info.origin.position.y = m_costmap.getOriginY();
+
+	for (int i = 0; i < m_cells * m_cells; ++i) {
+		switch (costs[i]) {
+		case costmap_2d::LETHAL_OBSTACLE: m_msg.data[i] = 100; break;
+		case costmap_2d::NO_INFORMATION:  m_msg.data[i] = -1;  break;
+		default:                          m_msg.data[i] = 0;   break;
+		}
+	}
+	m_pub.publish(m_msg);
 }
 
 };
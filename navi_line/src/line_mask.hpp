@@ -1,19 +1,82 @@
 #ifndef LINE_MASK_HPP_
 #define LINE_MASK_HPP_
 
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <costmap_2d/costmap_2d.h>
+#include <nav_msgs/OccupancyGrid.h>
+#include <nodelet/nodelet.h>
+#include <pcl/point_types.h>
+#include <pcl_ros/point_cloud.h>
+#include <ros/ros.h>
+#include <tf/transform_listener.h>
+
 namespace navi_line {
 
-using costmap_2d::Costmap2DROS;
+typedef pcl::PointCloud<pcl::PointXYZ> PointCloudXYZ;
 
-class LineMaskNode {
+/**
+ * Rolling costmap of painted lines around the robot. Line points are written
+ * directly into the cells of the costmap: the cells between the robot and
+ * each line point are cleared and the cells covered by the line are marked as
+ * lethal obstacles.
+ */
+class LineMaskNode : public nodelet::Nodelet {
 public:
-	LineMaskNode(void);
 	virtual void onInit(void);
+	void PointCallback(PointCloudXYZ::ConstPtr const &pc);
+
+protected:
+	/**
+	 * Shift the costmap so that it stays centered on the robot. Cells that
+	 * leave the window are forgotten and cells that enter it are free.
+	 *
+	 * \param robot_x position of the robot in the odometry frame
+	 * \param robot_y position of the robot in the odometry frame
+	 */
+	void UpdateOrigin(double robot_x, double robot_y);
+
+	/**
+	 * Free every cell on the line from (x0, y0) up to, but not including,
+	 * (x1, y1). Both endpoints must be inside the costmap.
+	 */
+	void ClearRay(int x0, int y0, int x1, int y1);
+
+	/**
+	 * Mark every cell that is covered by a line centered at (x, y).
+	 */
+	void MarkFootprint(int x, int y);
+
+	void PublishMask(ros::Time stamp);
 
 private:
-	ros::NodeHandle nh, nh_priv;
+	boost::shared_ptr<tf::TransformListener> m_tf;
+	ros::Subscriber m_sub;
+	ros::Publisher m_pub;
+
+	std::string m_fr_odom;
+	std::string m_fr_base;
+	double m_width;
+	double m_resolution;
+	double m_line_radius;
+	double m_raytrace_range;
+
+	costmap_2d::Costmap2D m_costmap;
+	int m_cells;
+
+	// Offsets of the cells covered by a line, relative to its center.
+	std::vector<std::pair<int, int> > m_footprint;
+
+	// Cells that contain at least one line point in the current pointcloud.
+	// A cell is only used once per pointcloud if its stamp matches the
+	// current generation.
+	std::vector<int> m_endpoints;
+	std::vector<uint32_t> m_stamp;
+	uint32_t m_generation;
 
-	boost::shared_ptr<Costmap2DROS> m_costmap;
+	nav_msgs::OccupancyGrid m_msg;
 };
 
 };
@@ -1,30 +1,39 @@
-#include <pcl/filters/statistical_outlier_removal.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
 #include <pcl_ros/point_cloud.h>
-#include <pcl_ros/transforms.h>
-#include <message_filters/subscriber.h>
-#include <message_filters/synchronizer.h>
-#include <message_filters/sync_policies/approximate_time.h>
+#include <pluginlib/class_list_macros.h>
 #include <tf/transform_listener.h>
 
 #include "line_mux.hpp"
 
+PLUGINLIB_DECLARE_CLASS(line_detection, mux_nodelet, line_tracking::MuxNodelet, nodelet::Nodelet)
+
 namespace line_tracking {
 
-// Nodelet Conversion
-MuxNodelet::MuxNodelet(void)
-	: nh_priv("~")
-{}
+// Cells are forgotten once their evidence decays below this.
+static float const kForgetEvidence = 0.05f;
 
-ros::NodeHandle &MuxNodelet::getNodeHandle(void)
+static void TransformPoints(PointCloudXYZ const &src, tf::Transform const &transform,
+                            pcl::PointXYZ *dst)
 {
-	return nh;
-}
+	tf::Matrix3x3 const &basis  = transform.getBasis();
+	tf::Vector3   const &origin = transform.getOrigin();
 
-ros::NodeHandle &MuxNodelet::getPrivateNodeHandle(void)
-{
-	return nh_priv;
+	float const r00 = basis[0][0], r01 = basis[0][1], r02 = basis[0][2];
+	float const r10 = basis[1][0], r11 = basis[1][1], r12 = basis[1][2];
+	float const r20 = basis[2][0], r21 = basis[2][1], r22 = basis[2][2];
+	float const tx  = origin.x(), ty = origin.y(), tz = origin.z();
+
+	for (size_t i = 0; i < src.points.size(); ++i) {
+		pcl::PointXYZ const &pt = src.points[i];
+		dst[i].x = r00 * pt.x + r01 * pt.y + r02 * pt.z + tx;
+		dst[i].y = r10 * pt.x + r11 * pt.y + r12 * pt.z + ty;
+		dst[i].z = r20 * pt.x + r21 * pt.y + r22 * pt.z + tz;
+	}
 }
-// Nodelet Conversion
 
 void MuxNodelet::onInit(void)
 {
@@ -32,73 +41,275 @@ void MuxNodelet::onInit(void)
 	ros::NodeHandle nh_priv = getPrivateNodeHandle();
 
 	nh_priv.param<double>("cache_time", m_cache_time, 1.0);
-	nh_priv.param<double>("sod_mean",   m_sod_mean,   10.0);
-	nh_priv.param<double>("sod_stddev", m_sod_stddev, 0.5);
+	nh_priv.param<double>("rate",       m_rate,       20.0);
+	nh_priv.param<double>("window",     m_window,     0.1);
+	nh_priv.param<int>("threads",       m_threads,    0);
 	nh_priv.param<std::string>("frame_fixed", m_fr_fixed, "/base_link");
+	nh_priv.param<std::string>("frame_odom",  m_fr_odom,  "/odom");
+	ROS_ASSERT(m_rate > 0.0 && m_window >= 0.0);
+
+	nh_priv.param<double>("resolution",   m_resolution,   0.05);
+	nh_priv.param<double>("radius",       m_radius,       5.0);
+	nh_priv.param<double>("decay_time",   m_decay_time,   1.0);
+	nh_priv.param<double>("threshold",    m_threshold,    2.0);
+	nh_priv.param<double>("max_evidence", m_max_evidence, 10.0);
+	nh_priv.param<int>("min_neighbors",   m_min_neighbors, 1);
+	ROS_ASSERT(m_resolution > 0.0 && m_radius > 0.0 && m_decay_time > 0.0);
+
+	m_radius_cells = (int)ceil(m_radius / m_resolution);
+	m_size         = 2 * m_radius_cells + 1;
+
+	GridCell const empty = { 0, 0, 0.0f, false };
+	m_cells.assign(m_size * m_size, empty);
+	m_active.reserve(m_cells.size());
+
+	// Load the list of input topics from the parameter server.
+	std::vector<std::string> topics;
+
+	if (nh_priv.hasParam("inputs")) {
+		XmlRpc::XmlRpcValue inputs;
+		nh_priv.getParam("inputs", inputs);
+		ROS_ASSERT(inputs.getType() == XmlRpc::XmlRpcValue::TypeArray);
+
+		for (int i = 0; i < inputs.size(); ++i) {
+			XmlRpc::XmlRpcValue input = inputs[i];
+			ROS_ASSERT(input.getType() == XmlRpc::XmlRpcValue::TypeString);
+			topics.push_back(static_cast<std::string>(input));
+		}
+	} else {
+		topics.push_back("line_points1");
+		topics.push_back("line_points2");
+		topics.push_back("line_points3");
+	}
+	ROS_ASSERT(!topics.empty());
+
+	m_inputs.resize(topics.size());
+	m_latest.resize(topics.size());
+	m_pending.reserve(topics.size());
+	m_pending_slots.reserve(topics.size());
+
+	// Threads beyond the number of inputs would never have anything to do.
+	if (m_threads <= 0) {
+		m_threads = std::max<int>(boost::thread::hardware_concurrency(), 1);
+	}
+	m_threads = std::min<int>(m_threads, topics.size());
+	m_pool.reset(new navi_workers::WorkerPool(m_threads));
 
 	m_tf  = boost::make_shared<tf::TransformListener>(ros::Duration(m_cache_time));
 	m_pub = nh.advertise<PointCloudXYZ>("line_points", 10);
 
-	// FIXME: subscribers need to be wrapped in boost::shared_ptrs
-	mf::Subscriber<PointCloudXYZ> *sub_pc1 = new mf::Subscriber<PointCloudXYZ>(nh, "line_points1", 1);
-	mf::Subscriber<PointCloudXYZ> *sub_pc2 = new mf::Subscriber<PointCloudXYZ>(nh, "line_points2", 1);
-	mf::Subscriber<PointCloudXYZ> *sub_pc3 = new mf::Subscriber<PointCloudXYZ>(nh, "line_points3", 1);
-	Synchronizer *sub = new Synchronizer(SyncPolicy(20), *sub_pc1, *sub_pc2, *sub_pc3);
-	sub->registerCallback(&MuxNodelet::Callback, this);
+	for (size_t i = 0; i < m_inputs.size(); ++i) {
+		m_inputs[i].topic = topics[i];
+		m_inputs[i].sub   = nh.subscribe<PointCloudXYZ>(topics[i], 1,
+			boost::bind(&MuxNodelet::InputCallback, this, _1, i));
+	}
+	m_timer = nh.createTimer(ros::Duration(1.0 / m_rate), &MuxNodelet::TimerCallback, this);
+}
 
-	// Can't use boost::make_shared() because of reference parameters.
-	m_sub = boost::shared_ptr<Synchronizer>(sub);
+void MuxNodelet::InputCallback(PointCloudXYZ::ConstPtr const &pc, size_t index)
+{
+	boost::atomic_store(&m_inputs[index].latest, pc);
 }
 
-void MuxNodelet::Callback(PointCloudXYZ::ConstPtr const &pc1,
-                          PointCloudXYZ::ConstPtr const &pc2,
-                          PointCloudXYZ::ConstPtr const &pc3)
+void MuxNodelet::TimerCallback(ros::TimerEvent const &event)
 {
-	PointCloudXYZ::Ptr merged = boost::make_shared<PointCloudXYZ>();
-	merged->header.stamp    = pc1->header.stamp;
-	merged->header.frame_id = m_fr_fixed;
-
-	// Transform the inputs into the fixed frame and build a single pointcloud.
-	std::vector<PointCloudXYZ::ConstPtr> split;
-	split.push_back(pc1);
-	split.push_back(pc2);
-	split.push_back(pc3);
-
-	for (size_t i = 0; i < split.size(); ++i) {
-		PointCloudXYZ::ConstPtr pc       = split[i];
-		PointCloudXYZ::Ptr      pc_fixed = boost::make_shared<PointCloudXYZ>();
-
-		try {
-			m_tf->waitForTransform(m_fr_fixed, pc->header.frame_id, pc->header.stamp, ros::Duration(m_cache_time));
-			pcl_ros::transformPointCloud(m_fr_fixed, *pc, *pc_fixed, *m_tf);
-		} catch (tf::TransformException const &e) {
-			ROS_ERROR("%s", e.what());
-			return;
+	// Take a snapshot of the latest pointcloud from each input, skipping any
+	// that have already been merged.
+	ros::Time newest;
+
+	for (size_t i = 0; i < m_inputs.size(); ++i) {
+		PointCloudXYZ::ConstPtr pc = boost::atomic_load(&m_inputs[i].latest);
+
+		if (pc && pc->header.stamp > m_inputs[i].consumed) {
+			m_latest[i] = pc;
+			newest = std::max(newest, pc->header.stamp);
+		} else {
+			m_latest[i].reset();
+		}
+	}
+
+	// Inputs that fell more than the window behind the newest input, or
+	// behind the last published output, are dropped instead of being merged
+	// late; the output stamps never go backwards. Inputs whose transform has
+	// not arrived yet are left for a later tick, so the timer never waits on
+	// tf.
+	ros::Time const latest = std::max(newest, m_last_stamp);
+	ros::Time const oldest = std::max(m_last_stamp,
+		latest - ros::Duration(std::min(m_window, latest.toSec())));
+	ros::Time stamp;
+	m_pending.clear();
+	m_pending_slots.clear();
+
+	for (size_t i = 0; i < m_latest.size(); ++i) {
+		if (!m_latest[i]) continue;
+
+		std_msgs::Header const &header = m_latest[i]->header;
+		if (header.stamp < oldest) {
+			m_inputs[i].consumed = header.stamp;
+		} else if (m_tf->canTransform(m_fr_odom, header.frame_id, header.stamp)) {
+			m_pending.push_back(m_latest[i]);
+			m_pending_slots.push_back(i);
+			stamp = std::max(stamp, header.stamp);
+		}
+	}
+	if (m_pending.empty() || !m_tf->canTransform(m_fr_odom, m_fr_fixed, stamp)) return;
+
+	for (size_t i = 0; i < m_pending.size(); ++i) {
+		m_inputs[m_pending_slots[i]].consumed = m_pending[i]->header.stamp;
+	}
+	Merge(m_pending, stamp);
+}
+
+void MuxNodelet::Merge(std::vector<PointCloudXYZ::ConstPtr> const &pcs, ros::Time stamp)
+{
+	// Look up every transform before touching any points. The inputs are
+	// transformed into the odometry frame, where the grid lives, so evidence
+	// from earlier frames stays put as the robot moves.
+	tf::StampedTransform fixed_to_odom;
+	m_transforms.resize(pcs.size());
+
+	try {
+		for (size_t i = 0; i < pcs.size(); ++i) {
+			std_msgs::Header const &header = pcs[i]->header;
+			m_tf->lookupTransform(m_fr_odom, header.frame_id, header.stamp, m_transforms[i]);
 		}
-		merged->points.insert(merged->points.end(), pc_fixed->points.begin(), pc_fixed->points.end());
+		m_tf->lookupTransform(m_fr_odom, m_fr_fixed, stamp, fixed_to_odom);
+	} catch (tf::TransformException const &e) {
+		ROS_ERROR("%s", e.what());
+		return;
+	}
+
+	// Each input is transformed directly into its own slice of the merged
+	// pointcloud, so the inputs can be processed in parallel without copying.
+	m_offsets.assign(pcs.size() + 1, 0);
+	for (size_t i = 0; i < pcs.size(); ++i) {
+		m_offsets[i + 1] = m_offsets[i] + pcs[i]->points.size();
 	}
+	m_merged.points.resize(m_offsets.back());
+	m_pool->Run(boost::bind(&MuxNodelet::TransformInputs, this, _1, &pcs));
+
+	int const center_x = (int)floor(fixed_to_odom.getOrigin().x() / m_resolution);
+	int const center_y = (int)floor(fixed_to_odom.getOrigin().y() / m_resolution);
+
+	// The timer never merges anything older than the last output, so the
+	// grid only needs to decay by the time that passed since then.
+	float decay = 1.0f;
+	if (!m_last_stamp.isZero()) {
+		decay = (float)exp(-(stamp - m_last_stamp).toSec() / m_decay_time);
+	}
+	m_last_stamp = stamp;
+
+	DecayGrid(center_x, center_y, decay);
+	AddEvidence(m_merged, center_x, center_y);
 
-	// Statistical Outlier Detection (SOD) filter.
 	PointCloudXYZ::Ptr filtered = boost::make_shared<PointCloudXYZ>();
 	filtered->header.frame_id = m_fr_fixed;
-	filtered->header.stamp    = pc1->header.stamp;
-
-	if (merged->points.size() > 0) {
-		pcl::StatisticalOutlierRemoval<pcl::PointXYZ> sor;
-		sor.setInputCloud(merged);
-		sor.setMeanK(m_sod_mean);
-		sor.setStddevMulThresh(m_sod_stddev);
-		sor.filter(*filtered);
-	}
+	filtered->header.stamp    = stamp;
+	ExtractPoints(fixed_to_odom.inverse(), *filtered);
 	m_pub.publish(filtered);
 }
-};
 
-int main(int argc, char **argv)
+void MuxNodelet::TransformInputs(int index, std::vector<PointCloudXYZ::ConstPtr> const *pcs)
+{
+	// Empty inputs have no slice to write into.
+	for (size_t i = index; i < pcs->size(); i += m_threads) {
+		PointCloudXYZ const &pc = *(*pcs)[i];
+		if (pc.points.empty()) continue;
+		TransformPoints(pc, m_transforms[i], &m_merged.points[m_offsets[i]]);
+	}
+}
+
+int MuxNodelet::GetCellIndex(int x, int y) const
+{
+	int const col = ((x % m_size) + m_size) % m_size;
+	int const row = ((y % m_size) + m_size) % m_size;
+	return row * m_size + col;
+}
+
+void MuxNodelet::DecayGrid(int center_x, int center_y, float decay)
+{
+	size_t i = 0;
+
+	while (i < m_active.size()) {
+		GridCell &cell = m_cells[m_active[i]];
+		cell.evidence *= decay;
+
+		bool const near = abs(cell.x - center_x) <= m_radius_cells
+		               && abs(cell.y - center_y) <= m_radius_cells;
+
+		if (near && cell.evidence >= kForgetEvidence) {
+			++i;
+		} else {
+			cell.active = false;
+			m_active[i] = m_active.back();
+			m_active.pop_back();
+		}
+	}
+}
+
+void MuxNodelet::AddEvidence(PointCloudXYZ const &pc, int center_x, int center_y)
+{
+	for (size_t i = 0; i < pc.points.size(); ++i) {
+		pcl::PointXYZ const &pt = pc.points[i];
+		double const dx = floor(pt.x / m_resolution) - center_x;
+		double const dy = floor(pt.y / m_resolution) - center_y;
+
+		// Also rejects NaNs, which fail every comparison.
+		if (!(fabs(dx) <= m_radius_cells && fabs(dy) <= m_radius_cells)) continue;
+
+		int const x     = center_x + (int)dx;
+		int const y     = center_y + (int)dy;
+		int const index = GetCellIndex(x, y);
+		GridCell &cell  = m_cells[index];
+
+		if (!cell.active) {
+			cell.x        = x;
+			cell.y        = y;
+			cell.evidence = 0.0f;
+			cell.active   = true;
+			m_active.push_back(index);
+		}
+		ROS_ASSERT(cell.x == x && cell.y == y);
+		cell.evidence = std::min<float>(cell.evidence + 1.0f, m_max_evidence);
+	}
+}
+
+void MuxNodelet::ExtractPoints(tf::Transform const &odom_to_fixed, PointCloudXYZ &dst)
 {
-	ros::init(argc, argv, "line_mux");
-	line_tracking::MuxNodelet node;
-	node.onInit();
-	ros::spin();
-	return 0;
+	float const threshold = m_threshold;
+	dst.points.clear();
+	dst.points.reserve(m_active.size());
+
+	for (size_t i = 0; i < m_active.size(); ++i) {
+		GridCell const &cell = m_cells[m_active[i]];
+		if (cell.evidence < threshold) continue;
+
+		// Count confirmed cells in the 8-neighborhood. Neighbors past the
+		// edge of the window wrap onto cells with different coordinates, so
+		// they are never counted.
+		int neighbors = 0;
+		for (int dy = -1; dy <= 1; ++dy)
+		for (int dx = -1; dx <= 1; ++dx) {
+			if (dx == 0 && dy == 0) continue;
+
+			GridCell const &other = m_cells[GetCellIndex(cell.x + dx, cell.y + dy)];
+			neighbors += other.active && other.evidence >= threshold
+			          && other.x == cell.x + dx && other.y == cell.y + dy;
+		}
+		if (neighbors < m_min_neighbors) continue;
+
+		// Line points lie on the ground, which is the plane z = 0 of the
+		// odometry frame.
+		tf::Point const pt_odom((cell.x + 0.5) * m_resolution, (cell.y + 0.5) * m_resolution, 0.0);
+		tf::Point const pt_fixed = odom_to_fixed * pt_odom;
+
+		pcl::PointXYZ pt;
+		pt.x = pt_fixed.x();
+		pt.y = pt_fixed.y();
+		pt.z = pt_fixed.z();
+		dst.points.push_back(pt);
+	}
+	dst.width  = dst.points.size();
+	dst.height = 1;
 }
+};
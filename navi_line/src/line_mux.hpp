@@ -3,42 +3,134 @@
 
 #include <pcl/point_types.h>
 #include <pcl_ros/point_cloud.h>
-#include <pcl_ros/transforms.h>
-#include <message_filters/subscriber.h>
-#include <message_filters/synchronizer.h>
-#include <message_filters/sync_policies/approximate_time.h>
+#include <nodelet/nodelet.h>
 #include <tf/transform_listener.h>
+#include <boost/scoped_ptr.hpp>
+#include <navi_workers/worker_pool.h>
 
 namespace line_tracking {
 
-namespace mf = message_filters;
-
 typedef pcl::PointCloud<pcl::PointXYZ> PointCloudXYZ;
-typedef mf::sync_policies::ApproximateTime<PointCloudXYZ, PointCloudXYZ, PointCloudXYZ> SyncPolicy;
-typedef mf::Synchronizer<SyncPolicy> Synchronizer;
 
-class MuxNodelet {
-public:
-	MuxNodelet(void);
-	ros::NodeHandle &getNodeHandle(void);
-	ros::NodeHandle &getPrivateNodeHandle(void);
+/**
+ * Line evidence accumulated in one cell of the tracking grid. The grid wraps
+ * around in both directions, so each cell remembers which cell of the odometry
+ * frame it currently holds.
+ */
+struct GridCell {
+	int x, y;
+	float evidence;
+	bool active;
+};
+
+/**
+ * Most recent pointcloud received on one input. The subscriber and the merge
+ * timer only exchange the pointer with boost::atomic_store() and
+ * boost::atomic_load(), so a slow merge never holds up a camera.
+ */
+struct InputSlot {
+	std::string topic;
+	ros::Subscriber sub;
+	PointCloudXYZ::ConstPtr latest;
+	ros::Time consumed;
+};
 
+class MuxNodelet : public nodelet::Nodelet {
+public:
 	virtual void onInit(void);
-	void Callback(PointCloudXYZ::ConstPtr const &pc1,
-	              PointCloudXYZ::ConstPtr const &pc2,
-	              PointCloudXYZ::ConstPtr const &pc3);
+	void InputCallback(PointCloudXYZ::ConstPtr const &pc, size_t index);
+	void TimerCallback(ros::TimerEvent const &event);
 
-private:
-	ros::NodeHandle nh, nh_priv;
+protected:
+	/**
+	 * Transform the pointclouds into the odometry frame, merge them into the
+	 * evidence grid, and publish the points that survive.
+	 *
+	 * \param pcs   new pointclouds, in any frames
+	 * \param stamp time at which the grid and the output are evaluated
+	 */
+	void Merge(std::vector<PointCloudXYZ::ConstPtr> const &pcs, ros::Time stamp);
+
+	/**
+	 * Transform every input whose index is congruent to index modulo the
+	 * number of threads into its slice of the merged pointcloud. This is the
+	 * job handed to the worker pool.
+	 */
+	void TransformInputs(int index, std::vector<PointCloudXYZ::ConstPtr> const *pcs);
+
+	/**
+	 * Decay the evidence in every active cell and forget cells that have
+	 * faded away or are no longer near the robot.
+	 *
+	 * \param center_x odometry-frame column of the cell under the robot
+	 * \param center_y odometry-frame row of the cell under the robot
+	 * \param decay    multiplier applied to all of the evidence
+	 */
+	void DecayGrid(int center_x, int center_y, float decay);
 
+	/**
+	 * Add one unit of evidence to the cell containing each point.
+	 *
+	 * \param pc       line points in the odometry frame
+	 * \param center_x odometry-frame column of the cell under the robot
+	 * \param center_y odometry-frame row of the cell under the robot
+	 */
+	void AddEvidence(PointCloudXYZ const &pc, int center_x, int center_y);
+
+	/**
+	 * Emit the center of every cell that has enough evidence and enough
+	 * neighbors that also have enough evidence. Isolated cells are treated
+	 * as outliers.
+	 *
+	 * \param odom_to_fixed transform from the odometry frame to the output frame
+	 * \param dst           output pointcloud
+	 */
+	void ExtractPoints(tf::Transform const &odom_to_fixed, PointCloudXYZ &dst);
+
+	int GetCellIndex(int x, int y) const;
+
+private:
 	boost::shared_ptr<tf::TransformListener> m_tf;
-	boost::shared_ptr<Synchronizer> m_sub;
 	ros::Publisher m_pub;
+	ros::Timer m_timer;
+
+	// One slot per input. This is sized before subscribing and never resized,
+	// so the subscribers can safely index into it.
+	std::vector<InputSlot> m_inputs;
+
+	// Scratch space for the merge timer, sized to match m_inputs.
+	std::vector<PointCloudXYZ::ConstPtr> m_latest;
+	std::vector<PointCloudXYZ::ConstPtr> m_pending;
+	std::vector<size_t> m_pending_slots;
+
+	// Per-input transforms and slices of the merged pointcloud, filled in by
+	// the worker pool.
+	int m_threads;
+	boost::scoped_ptr<navi_workers::WorkerPool> m_pool;
+	std::vector<tf::StampedTransform> m_transforms;
+	std::vector<size_t> m_offsets;
 
 	double m_cache_time;
-	double m_sod_mean;
-	double m_sod_stddev;
+	double m_rate;
+	double m_window;
 	std::string m_fr_fixed;
+	std::string m_fr_odom;
+
+	// Evidence grid in the odometry frame. Only cells within m_radius of the
+	// robot are kept, so a grid of m_size cells on a side is never aliased.
+	double m_resolution;
+	double m_radius;
+	double m_decay_time;
+	double m_threshold;
+	double m_max_evidence;
+	int    m_min_neighbors;
+
+	int m_size;
+	int m_radius_cells;
+	ros::Time m_last_stamp;
+	std::vector<GridCell> m_cells;
+	std::vector<int> m_active;
+	PointCloudXYZ m_merged;
 };
 
 };
@@ -6,6 +6,7 @@
 #include <ros/ros.h>
 #include <cv_bridge/cv_bridge.h>
 #include <dynamic_reconfigure/server.h>
+#include <pluginlib/class_list_macros.h>
 #include <sensor_msgs/image_encodings.h>
 #include <opencv/cv.h>
 
@@ -16,23 +17,9 @@
 #define SAT 1
 #define VAL 2
 
-namespace navi_white {
-
-// nodelet conversion
-HackNodelet::HackNodelet(void)
-	: nh_priv("~")
-{}
-
-ros::NodeHandle &HackNodelet::getNodeHandle(void)
-{
-	return nh;
-}
+PLUGINLIB_DECLARE_CLASS(white_filter, hack_nodelet, navi_white::HackNodelet, nodelet::Nodelet)
 
-ros::NodeHandle &HackNodelet::getPrivateNodeHandle(void)
-{
-	return nh_priv;
-}
-// nodelet conversion
+namespace navi_white {
 
 void HackNodelet::onInit(void)
 {
@@ -45,8 +32,10 @@ void HackNodelet::onInit(void)
 	}
 
 	nh_priv.param<bool>("debug", m_debug, false);
-	// Use dynamic_reconfigure to get all other parameters.
-	m_srv_dr.setCallback(boost::bind(&HackNodelet::ReconfigureCallback, this, _1, _2));
+	// Use dynamic_reconfigure to get all other parameters. The server has to
+	// be created here to use the nodelet's private namespace.
+	m_srv_dr = boost::make_shared<dr::Server<NaviWhiteConfig> >(nh_priv);
+	m_srv_dr->setCallback(boost::bind(&HackNodelet::ReconfigureCallback, this, _1, _2));
 
 	m_it = boost::make_shared<image_transport::ImageTransport>(nh);
 	m_pub = m_it->advertise("white", 1);
@@ -74,6 +63,47 @@ void HackNodelet::ReconfigureCallback(NaviWhiteConfig &config, int32_t level)
 	m_shadow_val   = config.shadow_val;
 	m_sunlight_hue = config.sunlight_hue;
 	m_sunlight_val = config.sunlight_val;
+
+	boost::shared_ptr<std::vector<uint8_t> const> table = BuildTable();
+	boost::atomic_store(&m_table, table);
+}
+
+boost::shared_ptr<std::vector<uint8_t> > HackNodelet::BuildTable(void) const
+{
+	boost::shared_ptr<std::vector<uint8_t> > table = boost::make_shared<std::vector<uint8_t> >(1 << 24);
+
+	// Convert one 256x256 slice of the color cube at a time with the same
+	// cvtColor() that used to run on every frame, so the table matches it
+	// exactly.
+	cv::Mat bgr(256, 256, CV_8UC3), hsv;
+
+	for (int b = 0; b < 256; ++b) {
+		for (int g = 0; g < 256; ++g) {
+			cv::Vec3b *row = bgr.ptr<cv::Vec3b>(g);
+			for (int r = 0; r < 256; ++r) {
+				row[r] = cv::Vec3b(b, g, r);
+			}
+		}
+		cv::cvtColor(bgr, hsv, CV_BGR2HSV);
+
+		uint8_t *dst = &(*table)[b << 16];
+		for (int g = 0; g < 256; ++g) {
+			cv::Vec3b const *row = hsv.ptr<cv::Vec3b>(g);
+
+			for (int r = 0; r < 256; ++r) {
+				int const hue = row[r][HUE];
+				int const sat = row[r][SAT];
+				int const val = row[r][VAL];
+
+				bool const shadow   = hue > m_shadow_hue && val > m_shadow_val
+				                   && sat > m_sat_split;
+				bool const sunlight = hue > m_sunlight_hue && val > m_sunlight_val
+				                   && sat <= m_sat_split + 1;
+				dst[(g << 8) | r] = (shadow || sunlight) ? 255 : 0;
+			}
+		}
+	}
+	return table;
 }
 
 void HackNodelet::Callback(sensor_msgs::Image::ConstPtr const &msg_img)
@@ -99,79 +129,23 @@ void HackNodelet::Callback(sensor_msgs::Image::ConstPtr const &msg_img)
 		cv::cvtColor(src_8u, dst_8u, CV_BGR2GRAY);
 		cv::threshold(dst_8u, dst_8u, 150, 255, cv::THRESH_TOZERO);
 	} else {
-		cv::Mat hsv_8u;
-		std::vector<cv::Mat> hsv_ch;
-		cv::cvtColor(src_blur, hsv_8u, CV_BGR2HSV);
-		cv::split(hsv_8u, hsv_ch);
+		boost::shared_ptr<std::vector<uint8_t> const> table = boost::atomic_load(&m_table);
+		if (!table) return;
 
-		cv::Mat shadow_sat, sunlight_sat;
-		cv::threshold(hsv_ch[SAT], sunlight_sat, m_sat_split + 1, 255, cv::THRESH_BINARY_INV);
-		cv::threshold(hsv_ch[SAT], shadow_sat,   m_sat_split + 0, 255, cv::THRESH_BINARY);
+		uint8_t const *lut = &(*table)[0];
+		dst_8u.create(src_blur.rows, src_blur.cols, CV_8UC1);
 
-		cv::Mat shadow, shadow_hue, shadow_val;
-		cv::threshold(hsv_ch[HUE], shadow_hue, m_shadow_hue, 255, cv::THRESH_BINARY);
-		cv::threshold(hsv_ch[VAL], shadow_val, m_shadow_val, 255, cv::THRESH_BINARY);
-		cv::min(shadow_hue, shadow_val, shadow);
-		cv::min(shadow_sat, shadow,     shadow);
+		for (int y = 0; y < src_blur.rows; ++y) {
+			uint8_t const *src = src_blur.ptr<uint8_t>(y);
+			uint8_t *dst = dst_8u.ptr<uint8_t>(y);
 
-		cv::Mat sunlight, sunlight_hue, sunlight_val;
-		cv::threshold(hsv_ch[HUE], sunlight_hue, m_sunlight_hue, 255, cv::THRESH_BINARY);
-		cv::threshold(hsv_ch[VAL], sunlight_val, m_sunlight_val, 255, cv::THRESH_BINARY);
-		cv::min(sunlight_hue, sunlight_val, sunlight);
-		cv::min(sunlight_sat, sunlight,     sunlight);
-
-		cv::max(shadow, sunlight, dst_8u);
+			for (int x = 0; x < src_blur.cols; ++x) {
+				dst[x] = lut[(src[3 * x + 0] << 16) | (src[3 * x + 1] << 8) | src[3 * x + 2]];
+			}
+		}
 
 		if (m_debug) {
-			cv_bridge::CvImage msg_blur;
-			msg_blur.header   = msg_img->header;
-			msg_blur.encoding = enc::MONO8;
-			msg_blur.image    = src_blur;
-			m_pub_blur.publish(msg_blur.toImageMsg());
-
-			cv_bridge::CvImage msg_split;
-			msg_split.header   = msg_img->header;
-			msg_split.encoding = enc::MONO8;
-			msg_split.image    = shadow_sat;
-			m_pub_split.publish(msg_split.toImageMsg());
-
-			// Shadow
-			cv_bridge::CvImage msg_shadow_hue;
-			msg_shadow_hue.header   = msg_img->header;
-			msg_shadow_hue.encoding = enc::MONO8;
-			msg_shadow_hue.image    = shadow_hue;
-			m_pub_shadow_hue.publish(msg_shadow_hue.toImageMsg());
-
-			cv_bridge::CvImage msg_shadow_val;
-			msg_shadow_val.header   = msg_img->header;
-			msg_shadow_val.encoding = enc::MONO8;
-			msg_shadow_val.image    = shadow_val;
-			m_pub_shadow_val.publish(msg_shadow_val.toImageMsg());
-
-			cv_bridge::CvImage msg_shadow;
-			msg_shadow.header   = msg_img->header;
-			msg_shadow.encoding = enc::MONO8;
-			msg_shadow.image    = shadow;
-			m_pub_shadow.publish(msg_shadow.toImageMsg());
-
-			// Sunlight
-			cv_bridge::CvImage msg_sunlight_hue;
-			msg_sunlight_hue.header   = msg_img->header;
-			msg_sunlight_hue.encoding = enc::MONO8;
-			msg_sunlight_hue.image    = sunlight_hue;
-			m_pub_sunlight_hue.publish(msg_sunlight_hue.toImageMsg());
-
-			cv_bridge::CvImage msg_sunlight_val;
-			msg_sunlight_val.header   = msg_img->header;
-			msg_sunlight_val.encoding = enc::MONO8;
-			msg_sunlight_val.image    = sunlight_val;
-			m_pub_sunlight_val.publish(msg_sunlight_val.toImageMsg());
-
-			cv_bridge::CvImage msg_sunlight;
-			msg_sunlight.header   = msg_img->header;
-			msg_sunlight.encoding = enc::MONO8;
-			msg_sunlight.image    = sunlight;
-			m_pub_sunlight.publish(msg_sunlight.toImageMsg());
+			PublishDebug(src_blur, msg_img->header);
 		}
 	}
 
@@ -183,13 +157,80 @@ void HackNodelet::Callback(sensor_msgs::Image::ConstPtr const &msg_img)
 	m_pub.publish(msg_white.toImageMsg());
 }
 
-};
-
-int main(int argc, char **argv)
+void HackNodelet::PublishDebug(cv::Mat src_blur, std_msgs::Header const &header)
 {
-	ros::init(argc, argv, "hack_node");
-	navi_white::HackNodelet node;
-	node.onInit();
-	ros::spin();
-	return 0;
+	namespace enc = sensor_msgs::image_encodings;
+
+	cv::Mat hsv_8u;
+	std::vector<cv::Mat> hsv_ch;
+	cv::cvtColor(src_blur, hsv_8u, CV_BGR2HSV);
+	cv::split(hsv_8u, hsv_ch);
+
+	cv::Mat shadow_sat, sunlight_sat;
+	cv::threshold(hsv_ch[SAT], sunlight_sat, m_sat_split + 1, 255, cv::THRESH_BINARY_INV);
+	cv::threshold(hsv_ch[SAT], shadow_sat,   m_sat_split + 0, 255, cv::THRESH_BINARY);
+
+	cv::Mat shadow, shadow_hue, shadow_val;
+	cv::threshold(hsv_ch[HUE], shadow_hue, m_shadow_hue, 255, cv::THRESH_BINARY);
+	cv::threshold(hsv_ch[VAL], shadow_val, m_shadow_val, 255, cv::THRESH_BINARY);
+	cv::min(shadow_hue, shadow_val, shadow);
+	cv::min(shadow_sat, shadow,     shadow);
+
+	cv::Mat sunlight, sunlight_hue, sunlight_val;
+	cv::threshold(hsv_ch[HUE], sunlight_hue, m_sunlight_hue, 255, cv::THRESH_BINARY);
+	cv::threshold(hsv_ch[VAL], sunlight_val, m_sunlight_val, 255, cv::THRESH_BINARY);
+	cv::min(sunlight_hue, sunlight_val, sunlight);
+	cv::min(sunlight_sat, sunlight,     sunlight);
+
+	cv_bridge::CvImage msg_blur;
+	msg_blur.header   = header;
+	msg_blur.encoding = enc::MONO8;
+	msg_blur.image    = src_blur;
+	m_pub_blur.publish(msg_blur.toImageMsg());
+
+	cv_bridge::CvImage msg_split;
+	msg_split.header   = header;
+	msg_split.encoding = enc::MONO8;
+	msg_split.image    = shadow_sat;
+	m_pub_split.publish(msg_split.toImageMsg());
+
+	// Shadow
+	cv_bridge::CvImage msg_shadow_hue;
+	msg_shadow_hue.header   = header;
+	msg_shadow_hue.encoding = enc::MONO8;
+	msg_shadow_hue.image    = shadow_hue;
+	m_pub_shadow_hue.publish(msg_shadow_hue.toImageMsg());
+
+	cv_bridge::CvImage msg_shadow_val;
+	msg_shadow_val.header   = header;
+	msg_shadow_val.encoding = enc::MONO8;
+	msg_shadow_val.image    = shadow_val;
+	m_pub_shadow_val.publish(msg_shadow_val.toImageMsg());
+
+	cv_bridge::CvImage msg_shadow;
+	msg_shadow.header   = header;
+	msg_shadow.encoding = enc::MONO8;
+	msg_shadow.image    = shadow;
+	m_pub_shadow.publish(msg_shadow.toImageMsg());
+
+	// Sunlight
+	cv_bridge::CvImage msg_sunlight_hue;
+	msg_sunlight_hue.header   = header;
+	msg_sunlight_hue.encoding = enc::MONO8;
+	msg_sunlight_hue.image    = sunlight_hue;
+	m_pub_sunlight_hue.publish(msg_sunlight_hue.toImageMsg());
+
+	cv_bridge::CvImage msg_sunlight_val;
+	msg_sunlight_val.header   = header;
+	msg_sunlight_val.encoding = enc::MONO8;
+	msg_sunlight_val.image    = sunlight_val;
+	m_pub_sunlight_val.publish(msg_sunlight_val.toImageMsg());
+
+	cv_bridge::CvImage msg_sunlight;
+	msg_sunlight.header   = header;
+	msg_sunlight.encoding = enc::MONO8;
+	msg_sunlight.image    = sunlight;
+	m_pub_sunlight.publish(msg_sunlight.toImageMsg());
 }
+
+};
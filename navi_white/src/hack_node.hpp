@@ -4,27 +4,37 @@
 #include <vector>
 #include <opencv/cv.h>
 #include <image_transport/image_transport.h>
+#include <nodelet/nodelet.h>
 #include <sensor_msgs/Image.h>
 #include <navi_white/NaviWhiteConfig.h>
 
 namespace navi_white {
 namespace dr = dynamic_reconfigure;
 
-class HackNodelet {
+class HackNodelet : public nodelet::Nodelet {
 public:
-	// nodelet conversion
-	HackNodelet(void);
-	ros::NodeHandle &getNodeHandle(void);
-	ros::NodeHandle &getPrivateNodeHandle(void);
 	virtual void onInit(void);
-	// nodelet conversion
 
 	void ReconfigureCallback(NaviWhiteConfig &config, int32_t level);
 	void Callback(sensor_msgs::Image::ConstPtr const &ptr);
 
-private:
-	ros::NodeHandle nh, nh_priv;
+protected:
+	/**
+	 * Classify every 24-bit BGR color with the current thresholds. The output
+	 * only depends on the color of the (blurred) pixel, so this replaces all of
+	 * the per-frame HSV conversion and thresholding with one table lookup.
+	 *
+	 * \return table of 0 or 255, indexed by (blue << 16) | (green << 8) | red
+	 */
+	boost::shared_ptr<std::vector<uint8_t> > BuildTable(void) const;
+
+	/**
+	 * Publish the intermediate images of the thresholding pipeline that the
+	 * lookup table replaces. This is only used for tuning the thresholds.
+	 */
+	void PublishDebug(cv::Mat src_blur, std_msgs::Header const &header);
 
+private:
 	bool m_debug;
 	bool m_gazebo;
 
@@ -32,6 +42,9 @@ private:
 	int m_shadow_hue,   m_shadow_val;
 	int m_sunlight_hue, m_sunlight_val;
 
+	// Swapped with boost::atomic_store() so frames never see a table that is
+	// still being rebuilt.
+	boost::shared_ptr<std::vector<uint8_t> const> m_table;
 
 	boost::shared_ptr<image_transport::ImageTransport> m_it;
 	image_transport::Subscriber m_sub;
@@ -44,7 +57,7 @@ private:
 	image_transport::Publisher  m_pub_sunlight;
 	image_transport::Publisher  m_pub_sunlight_hue;
 	image_transport::Publisher  m_pub_sunlight_val;
-	dr::Server<NaviWhiteConfig> m_srv_dr;
+	boost::shared_ptr<dr::Server<NaviWhiteConfig> > m_srv_dr;
 };
 };
 #endif
@@ -1,7 +1,9 @@
+#include <algorithm>
 #include <fstream>
 #include <string>
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <ros/ros.h>
 #include <cv_bridge/cv_bridge.h>
@@ -29,7 +31,13 @@ void HistogramNodelet::onInit(void)
 	nh_priv.param<int>("kernel_size", m_ker_size, 3);
 	nh_priv.param<bool>("downsample", m_downsample, false);
 	m_method = CV_COMP_INTERSECT;
-	m_haystack = boost::make_shared<IntegralHistogram>(m_bins_hue, m_bins_sat);
+
+	int threads;
+	nh_priv.param<int>("threads", threads, 0);
+	if (threads <= 0) {
+		threads = std::max<int>(boost::thread::hardware_concurrency(), 1);
+	}
+	m_haystack = boost::make_shared<IntegralHistogram>(m_bins_hue, m_bins_sat, threads);
 
 	// Training data for target histogram.
 	double weight;
@@ -121,22 +129,8 @@ void HistogramNodelet::BuildNeedleHistogram(cv::Mat data, cv::MatND &needle)
 
 void HistogramNodelet::MatchNeedleHistogram(cv::Mat src, cv::Mat &dst)
 {
-	dst.create(src.rows, src.cols, CV_32FC1);
-	dst.setTo(0.0);
-	m_haystack->LoadImage(src);
-
-	for (int y = m_win_height / 2; y < src.rows - m_win_height / 2; ++y)
-	for (int x = m_win_width  / 2; x < src.cols - m_win_width  / 2; ++x) {
-		cv::Rect patch(cv::Point2i(x, y), cv::Size(m_win_width, m_win_height));
-
-		// TODO: Why is this exceeding the image dimensions?
-		// TODO: Is this off-by-one?
-		patch = patch & cv::Rect(0, 0, src.cols - 1, src.rows - 1);
-
-		cv::MatND hist_patch;
-		m_haystack->GetPatch(patch, hist_patch);
-		dst.at<float>(y, x) = cv::compareHist(hist_patch, m_needle, m_method);
-	}
+	cv::Size const window(m_win_width, m_win_height);
+	m_haystack->MatchPatches(src, dst, m_needle, window, m_method);
 }
 
 }
@@ -1,13 +1,31 @@
+#include <algorithm>
 #include <iostream>
+#include <boost/bind.hpp>
 #include "integral_histogram.hpp"
 
-IntegralHistogram::IntegralHistogram(int bins_hue, int bins_sat)
+IntegralHistogram::IntegralHistogram(int bins_hue, int bins_sat, int threads)
 	: m_bins_hue(bins_hue),
 	  m_bins_sat(bins_sat),
 	  m_rows(0),
-	  m_cols(0)
+	  m_cols(0),
+	  m_pool(threads)
 {}
 
+/**
+ * Add delta pixels to one bin and update the histogram intersection to match.
+ * Only the bin's own term of the intersection can change.
+ */
+static inline void UpdateBin(float *hist, float const *needle, int bin, float delta,
+                             double &score)
+{
+	if (bin < 0) return;
+
+	float const before = hist[bin];
+	float const after  = before + delta;
+	hist[bin] = after;
+	score += std::min(after, needle[bin]) - std::min(before, needle[bin]);
+}
+
 void IntegralHistogram::GetPatch(cv::Rect patch, cv::MatND &dst)
 {
 	CV_Assert(m_bins_hue > 0 && m_bins_sat > 0);
@@ -83,82 +101,117 @@ void IntegralHistogram::LoadImage(cv::Mat const &img)
 	}
 }
 
-// Half-implemented integral calculation code.
 void IntegralHistogram::MatchPatches(cv::Mat src, cv::Mat &dst,
                                      cv::MatND needle, cv::Size window, int method)
 {
-	int const xh = window.width  / 2;
-	int const yh = window.height / 2;
-	int const x1 = src.cols - xh - 1;
-	int const y1 = src.rows - yh - 1;
+	CV_Assert(src.type() == CV_8UC3);
+	CV_Assert(m_bins_hue > 0 && m_bins_sat > 0);
+	CV_Assert(needle.type() == CV_32F && needle.isContinuous());
+	CV_Assert((int)needle.total() == m_bins_hue * m_bins_sat);
+	CV_Assert(window.width > 0 && window.height > 0);
 
-	// Pre-allocate the destination image.
 	dst.create(src.rows, src.cols, CV_32FC1);
 	dst.setTo(0.0);
 
-	// Extract the HS-plane from the source BGR image.
-	std::vector<cv::Mat> dims;
+	// Find the bin of each pixel once. The bins match cv::calcHist() over the
+	// uniform range [0, 255), which ignores values of 255.
 	cv::Mat hsv;
 	cv::cvtColor(src, hsv, CV_BGR2HSV);
-	cv::split(hsv, dims);
-	cv::Mat &hue = dims[0];
-	cv::Mat &sat = dims[1];
+	m_pixel_bins.create(src.rows, src.cols, CV_16SC1);
+
+	for (int y = 0; y < src.rows; ++y) {
+		uint8_t const *px  = hsv.ptr<uint8_t>(y);
+		int16_t       *bin = m_pixel_bins.ptr<int16_t>(y);
+
+		for (int x = 0; x < src.cols; ++x) {
+			int const hue = px[3 * x + 0];
+			int const sat = px[3 * x + 1];
+			bin[x] = (hue < 255 && sat < 255)
+			       ? (hue * m_bins_hue / 255) * m_bins_sat + sat * m_bins_sat / 255
+			       : -1;
+		}
+	}
 
-	// Seed the recursion with the histogram centered at pixel (0, 0).
-	cv::Rect seed_rect(cv::Point(xh, yh), window);
-	cv::Mat arrays[] = { hsv(seed_rect) };
-	int chans[] = { 0, 1 };                   // hue and sat channels
-	int sizes[] = { m_bins_hue, m_bins_sat }; // bins per channel
-	float const range[]   = { 0, 255 };       // 8-bit channel depth
-	float const *ranges[] = { range, range };
-	cv::MatND hist, seed;
-	cv::calcHist(arrays, 1, chans, cv::Mat(), hist, 2, sizes, ranges, true, false);
-
-	for (int y = 0; y < y1; ++y) {
-		// Vertical incremental update.
-		if (y > 0) {
-			seed.copyTo(hist);
-			for (int dx = -xh; dx <= +xh; ++dx) {
-				// TODO: Modify the array bounds instead of checking in here.
-				bool in_x = 0 <= xh + dx    && xh + dx < src.cols;
-				bool in_y = 0 <= y - yh - 1 && y  + yh < src.rows;
-				if (!in_x || !in_y) continue;
-
-				int bin_old_hue = hue.at<uint8_t>(y - yh - 1, xh + dx) * m_bins_hue / 255;
-				int bin_old_sat = sat.at<uint8_t>(y - yh - 1, xh + dx) * m_bins_sat / 255;
-				int bin_new_hue = hue.at<uint8_t>(y + yh, xh + dx) * m_bins_hue / 255;
-				int bin_new_sat = sat.at<uint8_t>(y + yh, xh + dx) * m_bins_sat / 255;
-				--hist.at<float>(bin_old_hue, bin_old_sat);
-				++hist.at<float>(bin_new_hue, bin_new_sat);
-			}
+	// Rows where the window fits inside the image, split into one band per
+	// thread. The calling thread processes the first band itself.
+	int const yh     = window.height / 2;
+	int const y_end  = src.rows - window.height + yh + 1;
+	int const y_rows = y_end - yh;
+	if (y_rows <= 0 || src.cols < window.width) return;
+
+	int const threads = std::min(m_pool.GetThreads(), y_rows);
+	m_pool.Run(boost::bind(&IntegralHistogram::MatchBand, this, _1, threads,
+	                       needle, window, method, cv::Range(yh, y_end), &dst));
+}
+
+void IntegralHistogram::MatchBand(int index, int threads, cv::Mat const &needle, cv::Size window,
+                                  int method, cv::Range valid, cv::Mat *dst) const
+{
+	if (index >= threads) return;
+
+	int const y_rows = valid.size();
+	cv::Range const rows(valid.start + y_rows * index / threads,
+	                     valid.start + y_rows * (index + 1) / threads);
+	MatchRows(needle, window, method, rows, dst);
+}
+
+void IntegralHistogram::MatchRows(cv::Mat const &needle, cv::Size window, int method,
+                                  cv::Range rows, cv::Mat *dst) const
+{
+	int const xh      = window.width  / 2;
+	int const yh      = window.height / 2;
+	int const x_first = xh;
+	int const x_last  = m_pixel_bins.cols - window.width + xh;
+	bool const intersect = method == CV_COMP_INTERSECT;
+
+	std::vector<float> hist(m_bins_hue * m_bins_sat, 0.0f);
+	cv::Mat hist_mat(m_bins_hue, m_bins_sat, CV_32FC1, &hist[0]);
+	float const *needle_bins = needle.ptr<float>(0);
+	double score = 0.0;
+
+	// Seed the histogram with the first window of the band.
+	for (int y = rows.start - yh; y < rows.start - yh + window.height; ++y) {
+		int16_t const *bin = m_pixel_bins.ptr<int16_t>(y);
+		for (int x = x_first - xh; x < x_first - xh + window.width; ++x) {
+			UpdateBin(&hist[0], needle_bins, bin[x], +1.0f, score);
 		}
+	}
+
+	// Sweep the window back and forth across the rows so that it only ever
+	// moves by one pixel, and never has to be reset at the start of a row.
+	int x = x_first;
+
+	for (int y = rows.start; y < rows.end; ++y) {
+		int const step  = ((y - rows.start) % 2 == 0) ? +1 : -1;
+		int const x_end = (step > 0) ? x_last : x_first;
+		int const top   = y - yh;
+		float *score_row = dst->ptr<float>(y);
+
+		for (;;) {
+			score_row[x] = (intersect) ? score : cv::compareHist(hist_mat, needle, method);
+			if (x == x_end) break;
 
-		for (int x = 0; x < x1; ++x) {
 			// Horizontal incremental update.
-			if (x > 0) {
-				for (int dy = -yh; dy <= +yh; ++dy) {
-					// TODO: Modify the array bounds instead of checking in here.
-					bool in_x = 0 <= x - xh - 1 && x + xh < src.cols;
-					bool in_y = 0 <= y + dy     && y + dy < src.rows;
-					if (!in_x || !in_y) continue;
-
-					int bin_old_hue = hue.at<uint8_t>(y + dy, x - xh - 1) * m_bins_hue / 255;
-					int bin_old_sat = sat.at<uint8_t>(y + dy, x - xh - 1) * m_bins_sat / 255;
-					int bin_new_hue = hue.at<uint8_t>(y + dy, x + xh) * m_bins_hue / 255;
-					int bin_new_sat = sat.at<uint8_t>(y + dy, x + xh) * m_bins_sat / 255;
-					--hist.at<float>(bin_old_hue, bin_old_sat);
-					++hist.at<float>(bin_new_hue, bin_new_sat);
-				}
-			}
-			// Keep track of the first pixel for the vertical update.
-			else {
-				hist.copyTo(seed);
-			}
+			int const col_old = (step > 0) ? x - xh : x - xh + window.width - 1;
+			int const col_new = (step > 0) ? x - xh + window.width : x - xh - 1;
 
-			// Correlation of this patch with the needle.
-			dst.at<float>(y, x) = cv::compareHist(hist, needle, method);
+			for (int dy = 0; dy < window.height; ++dy) {
+				int16_t const *bin = m_pixel_bins.ptr<int16_t>(top + dy);
+				UpdateBin(&hist[0], needle_bins, bin[col_old], -1.0f, score);
+				UpdateBin(&hist[0], needle_bins, bin[col_new], +1.0f, score);
+			}
+			x += step;
 		}
 
-	}
+		// Vertical incremental update.
+		if (y + 1 < rows.end) {
+			int16_t const *bin_old = m_pixel_bins.ptr<int16_t>(top);
+			int16_t const *bin_new = m_pixel_bins.ptr<int16_t>(top + window.height);
 
+			for (int dx = x - xh; dx < x - xh + window.width; ++dx) {
+				UpdateBin(&hist[0], needle_bins, bin_old[dx], -1.0f, score);
+				UpdateBin(&hist[0], needle_bins, bin_new[dx], +1.0f, score);
+			}
+		}
+	}
 }
@@ -3,18 +3,49 @@
 
 #include <vector>
 #include <opencv/cv.h>
+#include <navi_workers/worker_pool.h>
 
 class IntegralHistogram {
 public:
-	IntegralHistogram(int bins_hue, int bins_sat);
+	IntegralHistogram(int bins_hue, int bins_sat, int threads = 1);
 	void LoadImage(cv::Mat const &img);
 	void GetPatch(cv::Rect patch, cv::MatND &dst);
+
+	/**
+	 * Compare the HS-histogram of the window around every pixel with the
+	 * needle. The window slides one pixel at a time, so each step only
+	 * updates the bins of the pixels that enter and leave the window. With
+	 * CV_COMP_INTERSECT the score is updated along with the bins; any other
+	 * method falls back to cv::compareHist() for every pixel.
+	 *
+	 * \param src    BGR image of type CV_8UC3
+	 * \param dst    score of the window centered on each pixel; pixels where
+	 *               the window does not fit in the image are zero
+	 * \param needle target histogram with the same bins as this histogram
+	 * \param window size of the sliding window
+	 * \param method comparison method passed to cv::compareHist()
+	 */
 	void MatchPatches(cv::Mat src, cv::Mat &dst, cv::MatND needle, cv::Size window, int method);
 
 private:
 	int m_bins_hue, m_bins_sat;
 	int m_rows, m_cols;
+	navi_workers::WorkerPool m_pool;
 	std::vector<std::vector<cv::Mat> > m_bins;
+
+	// Flattened bin of each pixel of the image being matched, or -1 if the
+	// pixel is outside the range of the histogram.
+	cv::Mat m_pixel_bins;
+
+	void MatchRows(cv::Mat const &needle, cv::Size window, int method,
+	               cv::Range rows, cv::Mat *dst) const;
+
+	/**
+	 * Run MatchRows() on the index-th of threads bands of the valid rows.
+	 * This is the job handed to m_pool.
+	 */
+	void MatchBand(int index, int threads, cv::Mat const &needle, cv::Size window,
+	               int method, cv::Range valid, cv::Mat *dst) const;
 };
 
 #endif
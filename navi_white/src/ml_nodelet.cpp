@@ -1,7 +1,11 @@
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <string>
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <ros/ros.h>
 #include <cv_bridge/cv_bridge.h>
@@ -23,26 +27,83 @@ void MLNodelet::onInit(void)
 
 	int n_max;
 	double weight;
-	std::string path, delim;
+	std::string path, delim, model_path;
 	nh_priv.param<int>("kernel_size", m_ker_size, 3);
 	nh_priv.param<int>("train_size",  n_max, 2500);
 	nh_priv.param<double>("svm_weight", weight, 0.5);
 	nh_priv.param<std::string>("train_path",  path,  "");
 	nh_priv.param<std::string>("train_delim", delim, ",");
+	nh_priv.param<std::string>("model_path",  model_path, "");
 
+	int table_size;
+	nh_priv.param<int>("table_size", table_size, 65);
+	nh_priv.param<bool>("interpolate", m_interpolate, false);
+
+	nh_priv.param<int>("threads", m_threads, 0);
+	if (m_threads <= 0) {
+		m_threads = std::max<int>(boost::thread::hardware_concurrency(), 1);
+	}
+	m_pool.reset(new navi_workers::WorkerPool(m_threads));
+
+	// Training takes minutes, so reuse the model from an earlier run if one
+	// was saved. Delete the file to retrain. A model that fails to load is
+	// retrained and overwritten instead of taking down the whole manager.
+	bool loaded = false;
+	std::ifstream model(model_path.c_str());
+	if (!model_path.empty() && model.good()) {
+		model.close();
+		try {
+			m_ml.load(model_path.c_str());
+			loaded = m_ml.get_support_vector_count() > 0;
+		} catch (cv::Exception const &e) {
+			NODELET_WARN("unable to load SVM from %s: %s", model_path.c_str(), e.what());
+		}
+	}
+
+	if (loaded) {
+		NODELET_INFO("loaded SVM with %d support vectors from %s",
+		             m_ml.get_support_vector_count(), model_path.c_str());
+	} else {
+		if (!Train(path, delim[0], n_max, weight)) return;
+
+		if (!model_path.empty()) {
+			try {
+				m_ml.save(model_path.c_str());
+				NODELET_INFO("saved SVM to %s", model_path.c_str());
+			} catch (cv::Exception const &e) {
+				NODELET_WARN("unable to save SVM to %s: %s", model_path.c_str(), e.what());
+			}
+		}
+	}
+
+	// Classify the BGR cube in advance. Otherwise every pixel is classified
+	// by the SVM, which is far too slow to run on every frame.
+	if (table_size >= 2) {
+		BuildTable(table_size);
+		NODELET_INFO("built %dx%dx%d SVM lookup table", table_size, table_size, table_size);
+	}
+
+	// Subscribers and publishers.
+	m_it = boost::make_shared<image_transport::ImageTransport>(nh);
+	m_pub = m_it->advertise("white", 1);
+	m_sub = m_it->subscribe("image", 1, &MLNodelet::Callback, this);
+}
+
+bool MLNodelet::Train(std::string path, char delim, int n_max, double weight)
+{
 	// Load training data from a CSV file.
 	std::fstream stream(path.c_str(), std::ios::in);
 	cv::Mat features, labels;
 	if (!stream.good()) {
 		NODELET_ERROR("unable to open training data");
-		return;
+		return false;
 	}
 
-	bool valid = Parse(stream, features, labels, delim[0]);
+	bool valid = Parse(stream, features, labels, delim);
 	stream.close();
 	if (!valid) {
 		NODELET_ERROR("training data is invalid");
-		return;
+		return false;
 	}
 	features = features / 255.0;
 	NODELET_INFO("loaded %d training points", features.rows);
@@ -76,22 +137,36 @@ void MLNodelet::onInit(void)
 	             features.rows,
 	             m_ml.get_support_vector_count()
 	);
+	return true;
+}
 
-	// Subscribers and publishers.
-	m_it = boost::make_shared<image_transport::ImageTransport>(nh);
-	m_pub = m_it->advertise("white", 1);
-	m_sub = m_it->subscribe("image", 1, &MLNodelet::Callback, this);
+void MLNodelet::Predict(cv::Mat features, float *dst, cv::Range rows) const
+{
+	for (int i = rows.start; i < rows.end; ++i) {
+		CvMat feature = features.row(i);
+		dst[i] = m_ml.predict(&feature);
+	}
 }
 
-void MLNodelet::FilterWhite(cv::Mat bgr_8u, cv::Mat &dst)
+void MLNodelet::PredictParallel(cv::Mat features, float *dst) const
 {
-	int rows = bgr_8u.rows;
-	int cols = bgr_8u.cols;
+	// The calling thread predicts the first batch itself.
+	int const threads = std::max(1, std::min(m_threads, features.rows));
+	m_pool->Run(boost::bind(&MLNodelet::PredictBatch, this, _1, threads, features, dst));
+}
+
+void MLNodelet::PredictBatch(int index, int threads, cv::Mat features, float *dst) const
+{
+	if (index >= threads) return;
 
-	dst.create(rows * cols, 1, CV_32FC1);
+	int const n = features.rows;
+	Predict(features, dst, cv::Range(n * index / threads, n * (index + 1) / threads));
+}
 
-	cv::Mat bgr;
-	bgr_8u.convertTo(bgr, CV_32FC3);
+void MLNodelet::GetFeatures(cv::Mat bgr, cv::Mat &dst)
+{
+	int rows = bgr.rows;
+	int cols = bgr.cols;
 
 	// BGR-space, HSV-space
 	std::vector<cv::Mat> ch_bgr(3), ch_hsv(3);
@@ -102,22 +177,93 @@ void MLNodelet::FilterWhite(cv::Mat bgr_8u, cv::Mat &dst)
 
 	// BGRHSV-space, the feature space
 	std::vector<cv::Mat> features;
-	cv::Mat bgrhsv;
 	features.insert(features.end(), ch_bgr.begin(), ch_bgr.end());
 	features.insert(features.end(), ch_hsv.begin(), ch_hsv.end());
-	cv::merge(features, bgrhsv);
-	bgrhsv = bgrhsv.reshape(1, cols * rows);
-	bgrhsv = bgrhsv / 255.0;
-
-	// Classify each point.
-	for (int i = 0; i < bgrhsv.rows; ++i) {
-		CvMat  feature = bgrhsv.row(i);
-		float &value   = dst.at<float>(i, 0);
-		value = m_ml.predict(&feature);
+	cv::merge(features, dst);
+	dst = dst.reshape(1, cols * rows);
+	dst = dst / 255.0;
+}
+
+void MLNodelet::BuildTable(int size)
+{
+	int const n = size * size * size;
+	float const step = 255.0f / (size - 1);
+
+	cv::Mat bgr(n, 1, CV_32FC3);
+	for (int b = 0; b < size; ++b)
+	for (int g = 0; g < size; ++g)
+	for (int r = 0; r < size; ++r) {
+		bgr.at<cv::Vec3f>((b * size + g) * size + r, 0) = cv::Vec3f(b * step, g * step, r * step);
+	}
+
+	cv::Mat bgrhsv;
+	GetFeatures(bgr, bgrhsv);
+
+	m_table.resize(n);
+	m_table_size = size;
+	PredictParallel(bgrhsv, &m_table[0]);
+}
+
+void MLNodelet::FilterWhite(cv::Mat bgr_8u, cv::Mat &dst)
+{
+	int rows = bgr_8u.rows;
+	int cols = bgr_8u.cols;
+
+	if (m_table.empty()) {
+		dst.create(rows * cols, 1, CV_32FC1);
+
+		cv::Mat bgr, bgrhsv;
+		bgr_8u.convertTo(bgr, CV_32FC3);
+		GetFeatures(bgr, bgrhsv);
+
+		// Classify each point.
+		PredictParallel(bgrhsv, dst.ptr<float>(0));
+		dst = dst.reshape(1, rows);
+	} else {
+		int const n      = m_table_size;
+		float const unit = (n - 1) / 255.0f;
+		float const *lut = &m_table[0];
+		dst.create(rows, cols, CV_32FC1);
+
+		for (int y = 0; y < rows; ++y) {
+			uint8_t const *src = bgr_8u.ptr<uint8_t>(y);
+			float *value = dst.ptr<float>(y);
+
+			for (int x = 0; x < cols; ++x) {
+				float const fb = src[3 * x + 0] * unit;
+				float const fg = src[3 * x + 1] * unit;
+				float const fr = src[3 * x + 2] * unit;
+
+				if (!m_interpolate) {
+					int const b = (int)(fb + 0.5f);
+					int const g = (int)(fg + 0.5f);
+					int const r = (int)(fr + 0.5f);
+					value[x] = lut[(b * n + g) * n + r];
+					continue;
+				}
+
+				// Trilinear interpolation between the eight surrounding lattice
+				// points. The upper corner is clamped on the faces of the cube.
+				int const b0 = std::min((int)fb, n - 2);
+				int const g0 = std::min((int)fg, n - 2);
+				int const r0 = std::min((int)fr, n - 2);
+				float const tb = fb - b0;
+				float const tg = fg - g0;
+				float const tr = fr - r0;
+
+				float const *c = lut + (b0 * n + g0) * n + r0;
+				float const c00 = c[0]             + tr * (c[1]             - c[0]);
+				float const c01 = c[n]             + tr * (c[n + 1]         - c[n]);
+				float const c10 = c[n * n]         + tr * (c[n * n + 1]     - c[n * n]);
+				float const c11 = c[n * n + n]     + tr * (c[n * n + n + 1] - c[n * n + n]);
+				float const c0  = c00 + tg * (c01 - c00);
+				float const c1  = c10 + tg * (c11 - c10);
+				value[x] = c0 + tb * (c1 - c0);
+			}
+		}
 	}
 
 	cv::Mat mono8;
-	dst = dst.reshape(1, rows);
 	cv::normalize(dst, mono8, 0, 255, cv::NORM_MINMAX, CV_8UC1);
 	dst = mono8;
 }
@@ -1,12 +1,15 @@
 #ifndef ML_NODELET_HPP_
 #define ML_NODELET_HPP_
 
+#include <string>
 #include <vector>
 #include <opencv/cv.h>
 #include <opencv/ml.h>
+#include <boost/scoped_ptr.hpp>
 #include <image_transport/image_transport.h>
 #include <nodelet/nodelet.h>
 #include <sensor_msgs/Image.h>
+#include <navi_workers/worker_pool.h>
 
 namespace white_filter {
 
@@ -18,6 +21,55 @@ public:
 	void FilterBlue(cv::Mat src, cv::Mat &dst);
 	void FilterWhite(cv::Mat src, cv::Mat &dst);
 
+protected:
+	/**
+	 * Train the SVM on labeled BGRHSV features loaded from a CSV file.
+	 *
+	 * \param path   path to the training data
+	 * \param delim  delimiter between columns of the CSV file
+	 * \param n_max  maximum number of training points to use
+	 * \param weight weight of the first class; the second has 1 - weight
+	 * \return false if the training data could not be loaded
+	 */
+	bool Train(std::string path, char delim, int n_max, double weight);
+
+	/**
+	 * Classify a batch of features with the SVM.
+	 *
+	 * \param features one row of six features per sample
+	 * \param dst      SVM output for each row of features
+	 * \param rows     rows of features to classify
+	 */
+	void Predict(cv::Mat features, float *dst, cv::Range rows) const;
+
+	/**
+	 * Split the features into one batch per thread and classify them with
+	 * Predict() concurrently.
+	 */
+	void PredictParallel(cv::Mat features, float *dst) const;
+
+	/**
+	 * Run Predict() on the index-th of threads batches of the features. This
+	 * is the job handed to the worker pool.
+	 */
+	void PredictBatch(int index, int threads, cv::Mat features, float *dst) const;
+
+	/**
+	 * Convert colors to the BGRHSV feature space the SVM was trained in.
+	 *
+	 * \param bgr colors of type CV_32FC3 with channels in [0, 255]
+	 * \param dst one row of six features per color, scaled to [0, 1]
+	 */
+	void GetFeatures(cv::Mat bgr, cv::Mat &dst);
+
+	/**
+	 * Evaluate the SVM once on every point of a regular lattice over the BGR
+	 * cube, so classifying a pixel becomes a table lookup.
+	 *
+	 * \param size number of lattice points along each axis of the cube
+	 */
+	void BuildTable(int size);
+
 private:
 	boost::shared_ptr<image_transport::ImageTransport> m_it;
 	image_transport::Subscriber m_sub;
@@ -25,6 +77,14 @@ private:
 
 	cv::SVM m_ml;
 	int m_ker_size;
+	int m_threads;
+	boost::scoped_ptr<navi_workers::WorkerPool> m_pool;
+
+	// SVM output at each lattice point, indexed by (blue * n + green) * n + red
+	// with n = m_table_size. Empty if every pixel is classified by the SVM.
+	std::vector<float> m_table;
+	int  m_table_size;
+	bool m_interpolate;
 
 	// for capstone demo using blue duck tape
 	bool m_use_blue;
@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <fstream>
+#include <limits>
 #include <string>
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
@@ -9,26 +13,16 @@
 #include <sensor_msgs/image_encodings.h>
 #include <opencv/cv.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "csv.hpp"
 #include "pca_nodelet.hpp"
 
-namespace white_filter {
-
-// nodelet conversion
-PCANodelet::PCANodelet(void)
-	: nh_priv("~")
-{}
-
-ros::NodeHandle &PCANodelet::getNodeHandle(void)
-{
-	return nh;
-}
+PLUGINLIB_DECLARE_CLASS(white_filter, pca_nodelet, white_filter::PCANodelet, nodelet::Nodelet)
 
-ros::NodeHandle &PCANodelet::getPrivateNodeHandle(void)
-{
-	return nh_priv;
-}
-// nodelet conversion
+namespace white_filter {
 
 void PCANodelet::onInit(void)
 {
@@ -89,66 +83,207 @@ void PCANodelet::onInit(void)
 	// Threshold for regions of low intensity (where H and S are undefined).
 	nh_priv.param<int>("value_min", m_min_value, 45.0);
 
+	// The transform is fixed, so every color can be classified up front.
+	bool lut;
+	nh_priv.param<bool>("lut", lut, false);
+	m_table_scale = 0.0f;
+
+	if (lut) {
+		BuildTable();
+		ROS_INFO("built %d MB lookup table of PCA distances",
+		         (int)(m_table.size() * sizeof(uint16_t) >> 20));
+	}
+
 	// Subscribers and publishers.
 	m_it = boost::make_shared<image_transport::ImageTransport>(nh);
 	m_pub = m_it->advertise("white", 1);
 	m_sub = m_it->subscribe("image", 1, &PCANodelet::Callback, this);
 }
 
-void PCANodelet::FilterWhite(cv::Mat bgr_8u, cv::Mat &dst)
+void PCANodelet::WhiteDistance(uint8_t const *src, float *dst, int count) const
 {
-	int rows = bgr_8u.rows;
-	int cols = bgr_8u.cols;
-
-	cv::Mat bgr;
-	bgr_8u.convertTo(bgr, CV_32FC3);
+	int const dims = m_transforms.size();
+	int i = 0;
+
+#if defined(__SSE2__)
+	__m128 const v_eps  = _mm_set1_ps(FLT_EPSILON);
+	__m128 const v_abs  = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 const v_zero = _mm_setzero_ps();
+
+	for (; i + 4 <= count; i += 4) {
+		uint8_t const *px = src + 3 * i;
+		__m128 const b = _mm_setr_ps(px[0], px[3], px[6], px[9]);
+		__m128 const g = _mm_setr_ps(px[1], px[4], px[7], px[10]);
+		__m128 const r = _mm_setr_ps(px[2], px[5], px[8], px[11]);
+
+		// Same conversion as cvtColor(CV_BGR2HSV) on floating point images.
+		__m128 const v    = _mm_max_ps(_mm_max_ps(b, g), r);
+		__m128 const diff = _mm_sub_ps(v, _mm_min_ps(_mm_min_ps(b, g), r));
+		__m128 const s    = _mm_div_ps(diff, _mm_add_ps(v, v_eps));
+		__m128 const k    = _mm_div_ps(_mm_set1_ps(60.0f), _mm_add_ps(diff, v_eps));
+
+		__m128 const h_r  = _mm_mul_ps(_mm_sub_ps(g, b), k);
+		__m128 const h_g  = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(b, r), k), _mm_set1_ps(120.0f));
+		__m128 const h_b  = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(r, g), k), _mm_set1_ps(240.0f));
+		__m128 const is_r = _mm_cmpeq_ps(v, r);
+		__m128 const is_g = _mm_andnot_ps(is_r, _mm_cmpeq_ps(v, g));
+		__m128 const is_b = _mm_andnot_ps(_mm_or_ps(is_r, is_g), _mm_cmpeq_ps(v, v));
+
+		__m128 h = _mm_or_ps(_mm_or_ps(_mm_and_ps(is_r, h_r), _mm_and_ps(is_g, h_g)),
+		                     _mm_and_ps(is_b, h_b));
+		h = _mm_add_ps(h, _mm_and_ps(_mm_cmplt_ps(h, v_zero), _mm_set1_ps(360.0f)));
+
+		__m128 const features[6] = { b, g, r, h, s, v };
+		__m128 sum = v_zero;
+
+		for (int dim = 0; dim < dims; ++dim) {
+			float const *coefs = &m_transforms[dim][0];
+			__m128 projected = _mm_set1_ps(-m_center[dim]);
+
+			for (int feature = 0; feature < 6; ++feature) {
+				projected = _mm_add_ps(projected, _mm_mul_ps(_mm_set1_ps(coefs[feature]),
+				                                             features[feature]));
+			}
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(m_weight[dim]),
+			                                 _mm_and_ps(projected, v_abs)));
+		}
+		_mm_storeu_ps(dst + i, sum);
+	}
+#endif
+
+	for (; i < count; ++i) {
+		uint8_t const *px = src + 3 * i;
+		float const b = px[0];
+		float const g = px[1];
+		float const r = px[2];
+
+		float const v    = std::max(std::max(b, g), r);
+		float const diff = v - std::min(std::min(b, g), r);
+		float const s    = diff / (v + FLT_EPSILON);
+		float const k    = 60.0f / (diff + FLT_EPSILON);
+
+		float h;
+		if (v == r) {
+			h = (g - b) * k;
+		} else if (v == g) {
+			h = (b - r) * k + 120.0f;
+		} else {
+			h = (r - g) * k + 240.0f;
+		}
+		if (h < 0.0f) h += 360.0f;
 
-	// BGR-space, HSV-space
-	std::vector<cv::Mat> ch_bgr(3), ch_hsv(3);
-	cv::Mat hsv;
-	cv::cvtColor(bgr, hsv, CV_BGR2HSV);
-	cv::split(bgr, ch_bgr);
-	cv::split(hsv, ch_hsv);
+		float const features[6] = { b, g, r, h, s, v };
+		float sum = 0.0f;
 
-	// BGRHSV-space, the feature space
-	std::vector<cv::Mat> features;
-	features.insert(features.end(), ch_bgr.begin(), ch_bgr.end());
-	features.insert(features.end(), ch_hsv.begin(), ch_hsv.end());
+		for (int dim = 0; dim < dims; ++dim) {
+			float const *coefs = &m_transforms[dim][0];
+			float projected = -m_center[dim];
 
-	// Find distances in the feature-space.
-	dst.create(rows, cols, CV_32FC1);
-	dst.setTo(0.0);
+			for (int feature = 0; feature < 6; ++feature) {
+				projected += coefs[feature] * features[feature];
+			}
+			sum += m_weight[dim] * std::fabs(projected);
+		}
+		dst[i] = sum;
+	}
+}
 
-	for (size_t transform = 0; transform < m_transforms.size(); ++transform) {
-		cv::Mat transformed(rows, cols, CV_32FC1, cv::Scalar(0.0));
+void PCANodelet::BuildTable(void)
+{
+	// Each slice of the color cube has constant blue.
+	int const slice = 1 << 16;
+	std::vector<uint8_t> colors(3 * slice);
+	std::vector<float> distances(slice);
+
+	for (int i = 0; i < slice; ++i) {
+		colors[3 * i + 1] = i >> 8;
+		colors[3 * i + 2] = i & 0xff;
+	}
 
-		// Transform the image into the correct space.
-		for (size_t feature = 0; feature < features.size(); ++feature) {
-			transformed += m_transforms[transform][feature] * features[feature];
+	// The first pass finds the largest distance to choose the quantization
+	// step and the second pass fills the table.
+	float max_distance = 0.0f;
+	m_table.resize(1 << 24);
+
+	for (int pass = 0; pass < 2; ++pass) {
+		float const scale = (max_distance > 0.0f) ? 65535.0f / max_distance : 0.0f;
+
+		for (int b = 0; b < 256; ++b) {
+			for (int i = 0; i < slice; ++i) {
+				colors[3 * i + 0] = b;
+			}
+			WhiteDistance(&colors[0], &distances[0], slice);
+
+			if (pass == 0) {
+				for (int i = 0; i < slice; ++i) {
+					max_distance = std::max(max_distance, distances[i]);
+				}
+			} else {
+				uint16_t *dst = &m_table[b << 16];
+				for (int i = 0; i < slice; ++i) {
+					dst[i] = cv::saturate_cast<uint16_t>(distances[i] * scale);
+				}
+			}
 		}
-
-		// Find the distance between each pixel and the cluster center.
-		// TODO: Convert to SSD instead of SAD.
-		dst += m_weight[transform] * cv::abs(transformed - m_center[transform]);
 	}
+	m_table_scale = (max_distance > 0.0f) ? max_distance / 65535.0f : 0.0f;
+}
+
+void PCANodelet::FilterWhite(cv::Mat bgr_8u, cv::Mat &dst)
+{
+	ROS_ASSERT(bgr_8u.type() == CV_8UC3);
+	int const rows = bgr_8u.rows;
+	int const cols = bgr_8u.cols;
 
-	cv::Mat mono8;
-	cv::normalize(dst, mono8, 0, 255, cv::NORM_MINMAX, CV_8UC1);
-	dst = mono8;
+	// Find distances in the feature-space.
+	m_distance.create(rows, cols, CV_32FC1);
+	float min_distance = std::numeric_limits<float>::infinity();
+	float max_distance = -std::numeric_limits<float>::infinity();
+
+	for (int y = 0; y < rows; ++y) {
+		uint8_t const *src = bgr_8u.ptr<uint8_t>(y);
+		float *distance = m_distance.ptr<float>(y);
+
+		if (m_table.empty()) {
+			WhiteDistance(src, distance, cols);
+		} else {
+			uint16_t const *lut = &m_table[0];
+			for (int x = 0; x < cols; ++x) {
+				int const index = (src[3 * x + 0] << 16) | (src[3 * x + 1] << 8) | src[3 * x + 2];
+				distance[x] = lut[index] * m_table_scale;
+			}
+		}
 
-	// Eliminate regions of low value where hue and sat are undefined.
-	cv::Mat val_8u;
-	ch_hsv[2].convertTo(val_8u, CV_8UC1);
+		for (int x = 0; x < cols; ++x) {
+			min_distance = std::min(min_distance, distance[x]);
+			max_distance = std::max(max_distance, distance[x]);
+		}
+	}
 
-	cv::Mat mask;
-	cv::threshold(val_8u, mask, m_min_value, 255, cv::THRESH_BINARY);
-	cv::min(dst, mask, dst);
+	// Normalize to the full 8-bit range like cv::normalize(NORM_MINMAX) and
+	// eliminate regions of low value where hue and sat are undefined.
+	double const range = (double)max_distance - min_distance;
+	float const scale  = (range > DBL_EPSILON) ? 255.0 / range : 0.0;
+	dst.create(rows, cols, CV_8UC1);
+
+	for (int y = 0; y < rows; ++y) {
+		uint8_t const *src = bgr_8u.ptr<uint8_t>(y);
+		float const *distance = m_distance.ptr<float>(y);
+		uint8_t *white = dst.ptr<uint8_t>(y);
+
+		for (int x = 0; x < cols; ++x) {
+			int const value = std::max(std::max(src[3 * x + 0], src[3 * x + 1]), src[3 * x + 2]);
+			white[x] = (value > m_min_value)
+			         ? cv::saturate_cast<uint8_t>((distance[x] - min_distance) * scale)
+			         : 0;
+		}
+	}
 }
 
 void PCANodelet::Callback(sensor_msgs::Image::ConstPtr const &msg_img)
 {
 	namespace enc = sensor_msgs::image_encodings;
-	cv::Mat src, dst;
+	cv::Mat src;
 
 	// Convert the message to the OpenCV datatype without copying it.
 	try {
@@ -166,23 +301,14 @@ void PCANodelet::Callback(sensor_msgs::Image::ConstPtr const &msg_img)
 	} else {
 		src_blur = src;
 	}
-	FilterWhite(src_blur, dst);
+	FilterWhite(src_blur, m_white);
 
-	// Convert the OpenCV data to an output message without copying.
+	// The message owns a copy of the data, so the buffer can be reused.
 	cv_bridge::CvImage msg_white;
 	msg_white.header   = msg_img->header;
 	msg_white.encoding = enc::MONO8;
-	msg_white.image    = dst;
+	msg_white.image    = m_white;
 	m_pub.publish(msg_white.toImageMsg());
 }
 
 };
-
-int main(int argc, char **argv)
-{
-	ros::init(argc, argv, "pca_node");
-	white_filter::PCANodelet node;
-	node.onInit();
-	ros::spin();
-	return 0;
-}
@@ -4,26 +4,40 @@
 #include <vector>
 #include <opencv/cv.h>
 #include <image_transport/image_transport.h>
+#include <nodelet/nodelet.h>
 #include <sensor_msgs/Image.h>
 
 namespace white_filter {
 
-class PCANodelet {
+class PCANodelet : public nodelet::Nodelet {
 public:
-	// nodelet conversion
-	PCANodelet(void);
-	ros::NodeHandle &getNodeHandle(void);
-	ros::NodeHandle &getPrivateNodeHandle(void);
 	virtual void onInit(void);
-	// nodelet conversion
 
 	void Callback(sensor_msgs::Image::ConstPtr const &ptr);
 	void FilterBlue(cv::Mat src, cv::Mat &dst);
 	void FilterWhite(cv::Mat src, cv::Mat &dst);
 
-private:
-	ros::NodeHandle nh, nh_priv;
+protected:
+	/**
+	 * Weighted distance from the line color in PCA-space of a run of pixels.
+	 * Each pixel is converted to BGRHSV, projected onto every PCA dimension
+	 * and compared with the center in a single pass, without any temporary
+	 * images.
+	 *
+	 * \param src   packed BGR pixels
+	 * \param dst   weighted SAD between each pixel and the center
+	 * \param count number of pixels
+	 */
+	void WhiteDistance(uint8_t const *src, float *dst, int count) const;
+
+	/**
+	 * Precompute WhiteDistance() for all 2^24 BGR colors. Distances are
+	 * quantized to 16 bits, which is well below the resolution of the
+	 * normalized 8-bit output.
+	 */
+	void BuildTable(void);
 
+private:
 	boost::shared_ptr<image_transport::ImageTransport> m_it;
 	image_transport::Subscriber m_sub;
 	image_transport::Publisher  m_pub;
@@ -33,6 +47,15 @@ private:
 	std::vector<std::vector<float> > m_transforms;
 	int m_ker_size;
 	int m_min_value;
+
+	// Optional table of quantized distances, indexed by
+	// (blue << 16) | (green << 8) | red.
+	std::vector<uint16_t> m_table;
+	float m_table_scale;
+
+	// Buffers that keep their size between frames.
+	cv::Mat m_distance;
+	cv::Mat m_white;
 };
 };
 #endif
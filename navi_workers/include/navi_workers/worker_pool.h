@@ -0,0 +1,54 @@
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace navi_workers {
+
+/**
+ * Fixed set of threads that stay alive between jobs. Run() hands the same job
+ * to every thread and blocks until all of them are done, so per-frame work can
+ * be split across cores without creating and joining threads on every frame.
+ * Only one thread may call Run() at a time.
+ */
+class WorkerPool : private boost::noncopyable {
+public:
+	typedef boost::function<void (int)> Job;
+
+	/**
+	 * \param threads total number of threads, including the one calling Run()
+	 */
+	explicit WorkerPool(int threads);
+	~WorkerPool(void);
+
+	int GetThreads(void) const { return m_threads; }
+
+	/**
+	 * Call job(i) once for each i in [0, GetThreads()). The calling thread
+	 * runs job(0) itself, then waits for the workers to finish the rest.
+	 */
+	void Run(Job const &job);
+
+private:
+	void Work(int index);
+
+	int m_threads;
+	boost::thread_group m_group;
+	boost::mutex m_mutex;
+	boost::condition_variable m_cond_start;
+	boost::condition_variable m_cond_done;
+
+	// Guarded by m_mutex. Each call to Run() bumps m_generation, which wakes
+	// the workers, and m_pending counts the workers that are still running.
+	Job m_job;
+	unsigned long m_generation;
+	int m_pending;
+	bool m_stop;
+};
+
+};
+#endif
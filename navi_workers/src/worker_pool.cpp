@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <navi_workers/worker_pool.h>
+
+namespace navi_workers {
+
+WorkerPool::WorkerPool(int threads)
+	: m_threads(std::max(threads, 1)),
+	  m_generation(0),
+	  m_pending(0),
+	  m_stop(false)
+{
+	for (int i = 1; i < m_threads; ++i) {
+		m_group.create_thread(boost::bind(&WorkerPool::Work, this, i));
+	}
+}
+
+WorkerPool::~WorkerPool(void)
+{
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_stop = true;
+	}
+	m_cond_start.notify_all();
+	m_group.join_all();
+}
+
+void WorkerPool::Run(Job const &job)
+{
+	if (m_threads == 1) {
+		job(0);
+		return;
+	}
+
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_job     = job;
+		m_pending = m_threads - 1;
+		++m_generation;
+	}
+	m_cond_start.notify_all();
+
+	job(0);
+
+	boost::mutex::scoped_lock lock(m_mutex);
+	while (m_pending > 0) {
+		m_cond_done.wait(lock);
+	}
+	m_job.clear();
+}
+
+void WorkerPool::Work(int index)
+{
+	unsigned long generation = 0;
+
+	for (;;) {
+		Job job;
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			while (!m_stop && m_generation == generation) {
+				m_cond_start.wait(lock);
+			}
+			if (m_stop) return;
+
+			generation = m_generation;
+			job = m_job;
+		}
+
+		job(index);
+
+		boost::mutex::scoped_lock lock(m_mutex);
+		if (--m_pending == 0) {
+			m_cond_done.notify_one();
+		}
+	}
+}
+
+};